@@ -0,0 +1,80 @@
+#include <algorithm>
+#include <cctype>
+#include "Autocomplete.h"
+
+using namespace std;
+
+static string lower(const string& s) {
+    string out = s;
+    for (char& c : out) c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+    return out;
+}
+
+static uint32_t trigram(const char* p) {
+    return uint32_t(uint8_t(p[0])) << 16 | uint32_t(uint8_t(p[1])) << 8 | uint8_t(p[2]);
+}
+
+void Autocomplete::build(const Timetable& tt) {
+    entries.clear();
+    postings.clear();
+    for (int st = 0; st < tt.n_stations(); ++st) {
+        Entry e = { "", -1, 0 };
+        int best = -1;
+        for (int i = tt.station_first[st]; i < tt.station_first[st + 1]; ++i) {
+            int sid = tt.station_stop[i], calls = tt.stop_first[sid + 1] - tt.stop_first[sid];
+            e.usage += calls;
+            if (calls > best) {
+                best = calls;
+                e.sid = sid;
+            }
+        }
+        e.name = lower(tt.stops.at(e.sid).name);
+        entries.push_back(move(e));
+    }
+    sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        return a.name != b.name ? a.name < b.name : a.usage > b.usage;
+        });
+    for (int i = 0; i < static_cast<int>(entries.size()); ++i) {
+        const string& name = entries[i].name;
+        for (size_t p = 0; p + 3 <= name.size(); ++p) {
+            auto& list = postings[trigram(name.data() + p)];
+            if (list.empty() || list.back() != i) list.push_back(i);
+        }
+    }
+}
+
+void Autocomplete::find(const string& query, int n, vector<int>& out) const {
+    string q = lower(query);
+    q.erase(0, q.find_first_not_of(" \t"));
+    q.erase(q.find_last_not_of(" \t") + 1);
+    if (q.empty() || n <= 0) return;
+    auto by_usage = [&](int a, int b) { return entries[a].usage > entries[b].usage; };
+
+    // Names starting with q form one run of the sorted array.
+    auto lo = lower_bound(entries.begin(), entries.end(), q, [](const Entry& e, const string& v) { return e.name < v; });
+    auto hi = lo;
+    while (hi != entries.end() && hi->name.compare(0, q.size(), q) == 0) ++hi;
+    vector<int> hits;
+    for (auto it = lo; it != hi; ++it) hits.push_back(static_cast<int>(it - entries.begin()));
+    size_t take = min(hits.size(), static_cast<size_t>(n));
+    partial_sort(hits.begin(), hits.begin() + take, hits.end(), by_usage);
+    for (size_t i = 0; i < take; ++i) out.push_back(entries[hits[i]].sid);
+    if (static_cast<int>(take) == n || q.size() < 3) return;
+
+    // Elsewhere in the name: candidates from the rarest trigram of q, checked
+    // against the whole query.
+    const vector<int>* rarest = nullptr;
+    for (size_t p = 0; p + 3 <= q.size(); ++p) {
+        auto it = postings.find(trigram(q.data() + p));
+        if (it == postings.end()) return;
+        if (!rarest || it->second.size() < rarest->size()) rarest = &it->second;
+    }
+    hits.clear();
+    for (int i : *rarest) {
+        const string& name = entries[i].name;
+        if (name.compare(0, q.size(), q) != 0 && name.find(q) != string::npos) hits.push_back(i);
+    }
+    size_t more = min(hits.size(), static_cast<size_t>(n) - take);
+    partial_sort(hits.begin(), hits.begin() + more, hits.end(), by_usage);
+    for (size_t i = 0; i < more; ++i) out.push_back(entries[hits[i]].sid);
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <cstdint>
+#include "Timetable.h"
+#include "robin_hood.h"
+
+// Stop name search for the UI, one entry per station. Names are lowercased
+// into a sorted array for prefix matches and into trigram postings for
+// substring matches; either way results rank by how many trips call at the
+// station.
+class Autocomplete {
+public:
+    void build(const Timetable& tt);
+    // Up to n stop ids, prefix matches before substring matches.
+    void find(const std::string& query, int n, std::vector<int>& out) const;
+
+private:
+    struct Entry {
+        std::string name; // lowercased
+        int sid; // the station's busiest stop
+        int usage;
+    };
+    std::vector<Entry> entries; // sorted by name
+    robin_hood::unordered_map<std::uint32_t, std::vector<int>> postings; // trigram -> entries, ascending
+};
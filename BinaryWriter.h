@@ -0,0 +1,44 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <cstdint>
+
+// Appends little-endian fixed-width fields to a caller-owned buffer, the
+// binary counterpart of JsonWriter. Offsets are written as placeholders and
+// patched once the data they point at has been laid out.
+class BinaryWriter {
+public:
+    explicit BinaryWriter(std::string& out, std::size_t reserve = 0) : out(out), base(out.size()) {
+        if (reserve) out.reserve(out.size() + reserve);
+    }
+
+    // Bytes written so far; what a later patch() or offset refers to.
+    std::uint32_t pos() const { return static_cast<std::uint32_t>(out.size() - base); }
+
+    BinaryWriter& u16(std::uint16_t v) { return put(v, 2); }
+    BinaryWriter& u32(std::uint32_t v) { return put(v, 4); }
+    BinaryWriter& i32(std::int32_t v) { return put(static_cast<std::uint32_t>(v), 4); }
+    BinaryWriter& bytes(std::string_view s) {
+        out.append(s.data(), s.size());
+        return *this;
+    }
+    // Zero bytes up to a multiple of four.
+    BinaryWriter& align() {
+        while (pos() % 4) out += '\0';
+        return *this;
+    }
+    void patch(std::uint32_t at, std::uint32_t v) {
+        for (int i = 0; i < 4; ++i) out[base + at + i] = static_cast<char>(v >> (8 * i));
+    }
+
+private:
+    BinaryWriter& put(std::uint32_t v, int n) {
+        char buf[4];
+        for (int i = 0; i < n; ++i) buf[i] = static_cast<char>(v >> (8 * i));
+        out.append(buf, n);
+        return *this;
+    }
+
+    std::string& out;
+    std::size_t base;
+};
@@ -0,0 +1,85 @@
+#include <sstream>
+#include <cstdlib>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+#include "Compress.h"
+
+using namespace std;
+
+void Precompressed::build(string body) {
+    identity = move(body);
+    if (!gzip_compress(identity, gzip) || gzip.size() >= identity.size()) gzip.clear();
+    if (!brotli_compress(identity, br) || br.size() >= identity.size()) br.clear();
+}
+
+const string& Precompressed::pick(const string& accept, const char*& encoding) const {
+    encoding = "";
+    if (!br.empty() && accepts(accept, "br")) {
+        encoding = "br";
+        return br;
+    }
+    if (!gzip.empty() && accepts(accept, "gzip")) {
+        encoding = "gzip";
+        return gzip;
+    }
+    return identity;
+}
+
+bool gzip_compress(const string& in, string& out) {
+#ifdef HAVE_ZLIB
+    z_stream zs = {};
+    // 15 window bits plus 16 selects the gzip wrapper.
+    if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) return false;
+    out.resize(deflateBound(&zs, static_cast<uLong>(in.size())));
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+    zs.avail_in = static_cast<uInt>(in.size());
+    zs.next_out = reinterpret_cast<Bytef*>(&out[0]);
+    zs.avail_out = static_cast<uInt>(out.size());
+    int rc = deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    return rc == Z_STREAM_END;
+#else
+    (void)in;
+    out.clear();
+    return false;
+#endif
+}
+
+bool brotli_compress(const string& in, string& out) {
+#ifdef HAVE_BROTLI
+    size_t size = BrotliEncoderMaxCompressedSize(in.size());
+    if (size == 0) return false;
+    out.resize(size);
+    if (!BrotliEncoderCompress(BROTLI_MAX_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, in.size(),
+        reinterpret_cast<const uint8_t*>(in.data()), &size, reinterpret_cast<uint8_t*>(&out[0]))) return false;
+    out.resize(size);
+    return true;
+#else
+    (void)in;
+    out.clear();
+    return false;
+#endif
+}
+
+bool accepts(const string& header, const string& token, bool wildcard) {
+    stringstream ss(header);
+    string item;
+    int named = -1, any = -1; // -1 unlisted, else whether q > 0
+    while (getline(ss, item, ',')) {
+        size_t b = item.find_first_not_of(" \t");
+        if (b == string::npos) continue;
+        size_t semi = item.find(';', b);
+        string name = item.substr(b, semi == string::npos ? string::npos : semi - b);
+        name.erase(name.find_last_not_of(" \t") + 1);
+        if (name != token && name != "*") continue;
+        size_t q = semi == string::npos ? string::npos : item.find("q=", semi);
+        (name == token ? named : any) = q == string::npos || atof(item.c_str() + q + 2) > 0;
+    }
+    // The token's own entry overrides "*".
+    return named >= 0 ? named == 1 : wildcard && any == 1;
+}
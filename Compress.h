@@ -0,0 +1,22 @@
+#pragma once
+#include <string>
+
+// A response body serialised once at startup, kept with its gzip and brotli
+// forms so every request after that is a copy. A form stays empty when the
+// build lacks its library (HAVE_ZLIB, HAVE_BROTLI) or it doesn't save space.
+struct Precompressed {
+    std::string identity, gzip, br;
+
+    void build(std::string body);
+    // The smallest form the Accept-Encoding header allows; encoding is set to
+    // its Content-Encoding, or left empty for identity.
+    const std::string& pick(const std::string& accept, const char*& encoding) const;
+};
+
+bool gzip_compress(const std::string& in, std::string& out);
+bool brotli_compress(const std::string& in, std::string& out);
+
+// Whether an Accept or Accept-Encoding header value lists `token`, or "*" when
+// wildcard is set (q=0 refuses it). Media types nobody asks for by accident,
+// such as the binary journey format, pass wildcard = false.
+bool accepts(const std::string& header, const std::string& token, bool wildcard = true);
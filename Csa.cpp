@@ -0,0 +1,86 @@
+#include <vector>
+#include <algorithm>
+#include "Csa.h"
+
+using namespace std;
+
+void build_connections(const Timetable& tt, Connections& cs) {
+    cs.conns.clear();
+    cs.conns.reserve(tt.ev_sid.size());
+    for (int t = 0; t < tt.n_trips(); ++t) {
+        for (int e = tt.trip_first[t]; e + 1 < tt.trip_first[t + 1]; ++e) {
+            cs.conns.push_back({ tt.ev_dep[e], tt.ev_arr[e + 1], tt.ev_sid[e], tt.ev_sid[e + 1], t, e });
+        }
+    }
+    stable_sort(cs.conns.begin(), cs.conns.end(),
+        [](const Connections::Conn& a, const Connections::Conn& b) { return a.dep < b.dep; });
+}
+
+bool run_csa(const vector<Seed>& seeds, const vector<Target>& targets, const Time& start_t,
+    const Timetable& tt, const Connections& cs, QueryContext& ctx) {
+    init_seeds(seeds, targets, start_t, ctx);
+
+    // One label per stop, packed like the round labels, and the boarding event
+    // of every trip already entered.
+    auto& lab = ctx.csa.lab;
+    auto& board = ctx.csa.board;
+    auto& lab_dirty = ctx.csa.lab_dirty;
+    auto& board_dirty = ctx.csa.board_dirty;
+    if (static_cast<int>(lab.size()) < tt.n_ids) lab.assign(tt.n_ids, EMPTY_L);
+    if (static_cast<int>(board.size()) < tt.n_trips()) board.assign(tt.n_trips(), -1);
+
+    int best = INF_T, best_sid = -1;
+    auto reach = [&](int sid, Packed l) {
+        if (lab[sid] <= l) return false;
+        if (lab[sid] == EMPTY_L) lab_dirty.push_back(sid);
+        lab[sid] = l;
+        if (ctx.egress[sid] != INF_T && arr_of(l) + ctx.egress[sid] < best) {
+            best = arr_of(l) + ctx.egress[sid];
+            best_sid = sid;
+        }
+        return true;
+    };
+    for (int sid : ctx.touched[0]) reach(sid, ctx.dp[0][sid]);
+
+    auto c = lower_bound(cs.conns.begin(), cs.conns.end(), ctx.start,
+        [](const Connections::Conn& a, int t) { return a.dep < t; });
+    for (; c != cs.conns.end() && c->dep < best; ++c) {
+        if ((++ctx.scanned & 4095) == 0 && ctx.out_of_time()) break;
+        int& b = board[c->trip];
+        if (b < 0) {
+            if (arr_of(lab[c->from]) > c->dep) continue;
+            b = c->ev;
+            board_dirty.push_back(c->trip);
+        }
+        if (!reach(c->to, pack(c->arr, static_cast<uint32_t>(b)))) continue;
+        auto tr = tt.transfers.find(c->to);
+        if (tr != tt.transfers.end()) {
+            for (const auto& t : tr->second) reach(t.v, pack(c->arr + t.dur, WALK | static_cast<uint32_t>(c->to)));
+        }
+    }
+
+    // Walk the journey back to a seed label, then replay it into the rounds.
+    auto& legs = ctx.csa.legs;
+    legs.clear();
+    for (int s = best_sid; s >= 0 && lab[s] != ctx.dp[0][s];) {
+        uint32_t code = static_cast<uint32_t>(lab[s]);
+        legs.push_back({ s, lab[s] });
+        s = (code & WALK) ? static_cast<int>(code & ~WALK) : tt.ev_sid[code];
+    }
+    int trips = 0;
+    for (const auto& l : legs) trips += (static_cast<uint32_t>(l.second) & WALK) ? 0 : 1;
+
+    for (int s : lab_dirty) lab[s] = EMPTY_L;
+    for (int t : board_dirty) board[t] = -1;
+    lab_dirty.clear();
+    board_dirty.clear();
+    if (trips > MAX_K) return false;
+
+    int k = 0;
+    for (auto it = legs.rbegin(); it != legs.rend(); ++it) {
+        if (!(static_cast<uint32_t>(it->second) & WALK)) ++k;
+        settle(ctx, k, it->first, it->second);
+    }
+    collect_profile(targets, tt, ctx);
+    return true;
+}
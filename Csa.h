@@ -0,0 +1,24 @@
+#pragma once
+#include <vector>
+#include "Timetable.h"
+#include "Raptor.h"
+
+// Every hop between consecutive stops of a trip, as one array sorted by
+// departure, for the Connection Scan Algorithm.
+struct Connections {
+    struct Conn {
+        int dep, arr, from, to, trip;
+        int ev; // departure event, the boarding event when the trip is entered here
+    };
+    std::vector<Conn> conns;
+};
+
+void build_connections(const Timetable& tt, Connections& cs);
+
+// Earliest-arrival search: one scan from the query time, stopping once
+// connections depart after the best target arrival. The single journey it
+// finds is written into ctx's round labels, so ctx.pred and ctx.profile read
+// as after run_raptor (with one journey rather than a Pareto set). Returns
+// false if that journey takes more than MAX_K trips.
+bool run_csa(const std::vector<Seed>& seeds, const std::vector<Target>& targets, const Time& start_t,
+    const Timetable& tt, const Connections& cs, QueryContext& ctx);
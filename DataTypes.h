@@ -6,6 +6,10 @@
 #include <algorithm>
 #include "robin_hood.h"
 
+constexpr double WALK_V = 1.4; // m/s
+constexpr double MAX_WALK = 1500; // m
+constexpr double STATION_R = 500; // m, same-named stops closer than this form one station
+
 struct Stop {
     int id;
     std::string name;
@@ -0,0 +1,158 @@
+#include <string>
+#include <cmath>
+#include <algorithm>
+#include "Isochrone.h"
+#include "JsonWriter.h"
+
+using namespace std;
+
+constexpr int ISO_SUB = 6; // ~250 m raster cells on the default grid
+constexpr size_t STOPS_PER_CHUNK = 512;
+
+void build_isochrone(int src, const Time& start_t, int budget_s, int bucket_s,
+    const Timetable& tt, QueryContext& ctx, Isochrone& iso) {
+    run_one_to_all(src, start_t, tt, ctx);
+    iso.start = ctx.start;
+    iso.limit = ctx.start + budget_s;
+    iso.bucket = max(60, bucket_s);
+    iso.stops.clear();
+
+    // No destination, so nothing is pruned: every labelled stop counts, and so
+    // does every stop a short walk beyond one.
+    vector<int> best(tt.n_ids, INF_T);
+    for (int k = 0; k <= MAX_K; ++k) {
+        for (int sid : ctx.touched[k]) {
+            int a = arr_of(ctx.dp[k][sid]);
+            best[sid] = min(best[sid], a);
+            for (int i = tt.walk_first[sid]; i < tt.walk_first[sid + 1]; ++i) {
+                best[tt.walk_to[i]] = min(best[tt.walk_to[i]], a + tt.walk_dur[i]);
+            }
+        }
+    }
+    double lat_lo = 90, lat_hi = -90, lon_lo = 180, lon_hi = -180;
+    for (int sid = 0; sid < tt.n_ids; ++sid) {
+        if (best[sid] > iso.limit) continue;
+        auto it = tt.stops.find(sid);
+        if (it == tt.stops.end()) continue;
+        iso.stops.push_back({ sid, best[sid] });
+        lat_lo = min(lat_lo, it->second.lat);
+        lat_hi = max(lat_hi, it->second.lat);
+        lon_lo = min(lon_lo, it->second.lon);
+        lon_hi = max(lon_hi, it->second.lon);
+    }
+    sort(iso.stops.begin(), iso.stops.end(),
+        [](const pair<int, int>& a, const pair<int, int>& b) { return a.second < b.second; });
+
+    iso.cell_t.clear();
+    iso.nx = iso.ny = 0;
+    const SpatialGrid& g = tt.grid;
+    if (iso.stops.empty() || g.nx == 0) return;
+
+    double ml = min(MAX_WALK, budget_s * WALK_V) / 111320.0;
+    double mo = ml / max(0.01, cos((lat_lo + lat_hi) / 2 * M_PI / 180.0));
+    int gx0 = static_cast<int>(floor((lon_lo - mo - g.lon0) / g.dlon));
+    int gx1 = static_cast<int>(floor((lon_hi + mo - g.lon0) / g.dlon));
+    int gy0 = static_cast<int>(floor((lat_lo - ml - g.lat0) / g.dlat));
+    int gy1 = static_cast<int>(floor((lat_hi + ml - g.lat0) / g.dlat));
+    iso.dlat = g.dlat / ISO_SUB;
+    iso.dlon = g.dlon / ISO_SUB;
+    iso.lat0 = g.lat0 + gy0 * g.dlat;
+    iso.lon0 = g.lon0 + gx0 * g.dlon;
+    iso.nx = (gx1 - gx0 + 1) * ISO_SUB;
+    iso.ny = (gy1 - gy0 + 1) * ISO_SUB;
+    iso.cell_t.assign(static_cast<size_t>(iso.nx) * iso.ny, INF_T);
+
+    for (const auto& p : iso.stops) {
+        const Stop& s = tt.stops.at(p.first);
+        double r = min(MAX_WALK, (iso.limit - p.second) * WALK_V);
+        double coslat = cos(s.lat * M_PI / 180.0);
+        double rl = r / 111320.0, ro = rl / max(0.01, coslat);
+        int y0 = max(0, static_cast<int>((s.lat - rl - iso.lat0) / iso.dlat));
+        int y1 = min(iso.ny - 1, static_cast<int>((s.lat + rl - iso.lat0) / iso.dlat));
+        int x0 = max(0, static_cast<int>((s.lon - ro - iso.lon0) / iso.dlon));
+        int x1 = min(iso.nx - 1, static_cast<int>((s.lon + ro - iso.lon0) / iso.dlon));
+        for (int y = y0; y <= y1; ++y) {
+            double dy = (iso.lat0 + (y + 0.5) * iso.dlat - s.lat) * 111320.0;
+            for (int x = x0; x <= x1; ++x) {
+                double dx = (iso.lon0 + (x + 0.5) * iso.dlon - s.lon) * 111320.0 * coslat;
+                double d = sqrt(dx * dx + dy * dy);
+                if (d > r) continue;
+                int& c = iso.cell_t[static_cast<size_t>(y) * iso.nx + x];
+                c = min(c, p.second + static_cast<int>(d / WALK_V));
+            }
+        }
+    }
+}
+
+// One band as a MultiPolygon of row runs, so adjacent cells share a rectangle.
+static void append_band(const Isochrone& iso, int b, int n_bands, JsonWriter& w) {
+    int from = b * iso.bucket, to = min((b + 1) * iso.bucket, iso.limit - iso.start);
+    w.begin_object().key("type").value("Feature");
+    w.key("properties").begin_object().key("from_min").value(from / 60).key("to_min").value(to / 60).end_object();
+    w.key("geometry").begin_object().key("type").value("MultiPolygon").key("coordinates").begin_array();
+    auto in_band = [&](int t) {
+        if (t > iso.limit) return false;
+        return min((t - iso.start) / iso.bucket, n_bands - 1) == b;
+    };
+    for (int y = 0; y < iso.ny; ++y) {
+        const int* row = iso.cell_t.data() + static_cast<size_t>(y) * iso.nx;
+        for (int x = 0; x < iso.nx;) {
+            if (!in_band(row[x])) {
+                ++x;
+                continue;
+            }
+            int x_end = x;
+            while (x_end + 1 < iso.nx && in_band(row[x_end + 1])) ++x_end;
+            double lon_w = iso.lon0 + x * iso.dlon, lon_e = iso.lon0 + (x_end + 1) * iso.dlon;
+            double s = iso.lat0 + y * iso.dlat, n = s + iso.dlat;
+            w.begin_array().begin_array();
+            w.begin_array().value(lon_w).value(s).end_array();
+            w.begin_array().value(lon_e).value(s).end_array();
+            w.begin_array().value(lon_e).value(n).end_array();
+            w.begin_array().value(lon_w).value(n).end_array();
+            w.begin_array().value(lon_w).value(s).end_array();
+            w.end_array().end_array();
+            x = x_end + 1;
+        }
+    }
+    w.end_array().end_object().end_object();
+}
+
+bool isochrone_chunk(const Isochrone& iso, const Timetable& tt, size_t part, string& out) {
+    out.clear();
+    size_t n_sc = (iso.stops.size() + STOPS_PER_CHUNK - 1) / STOPS_PER_CHUNK;
+    int n_bands = max(1, (iso.limit - iso.start + iso.bucket - 1) / iso.bucket);
+
+    if (part == 0) {
+        out = "{\"stops\":[";
+        return true;
+    }
+    if (part <= n_sc) {
+        size_t lo = (part - 1) * STOPS_PER_CHUNK;
+        size_t hi = min(iso.stops.size(), lo + STOPS_PER_CHUNK);
+        JsonWriter w(out, 80 * (hi - lo));
+        w.resume(lo > 0);
+        for (size_t i = lo; i < hi; ++i) {
+            const Stop& s = tt.stops.at(iso.stops[i].first);
+            w.begin_object().key("stop_id").value(s.id).key("lat").value(s.lat).key("lon").value(s.lon);
+            w.key("duration").value(iso.stops[i].second - iso.start).end_object();
+        }
+        return true;
+    }
+    part -= n_sc + 1;
+    if (part == 0) {
+        out = "],\"isochrone\":{\"type\":\"FeatureCollection\",\"features\":[";
+        return true;
+    }
+    if (part <= static_cast<size_t>(n_bands)) {
+        JsonWriter w(out);
+        w.resume(part > 1);
+        append_band(iso, static_cast<int>(part - 1), n_bands, w);
+        return true;
+    }
+    if (part == static_cast<size_t>(n_bands) + 1) {
+        out = "]}}";
+        return true;
+    }
+    return false;
+}
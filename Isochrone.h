@@ -0,0 +1,26 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <utility>
+#include "Timetable.h"
+#include "Raptor.h"
+
+// Everywhere reachable from one stop within a time budget. Walking buffers
+// around the reached stops are rasterised on the timetable's SpatialGrid,
+// each grid cell split into ISO_SUB x ISO_SUB, restricted to the window the
+// reached stops cover.
+struct Isochrone {
+    int start = 0, limit = 0, bucket = 0;
+    std::vector<std::pair<int, int>> stops; // (stop id, arrival), by arrival
+
+    int nx = 0, ny = 0;
+    double lat0 = 0, lon0 = 0, dlat = 0, dlon = 0;
+    std::vector<int> cell_t; // earliest arrival per raster cell, INF_T if none
+};
+
+void build_isochrone(int src, const Time& start_t, int budget_s, int bucket_s,
+    const Timetable& tt, QueryContext& ctx, Isochrone& iso);
+
+// Streams the result as JSON in pieces: reached stops in blocks, then one
+// GeoJSON feature per time band. Returns false once every piece is written.
+bool isochrone_chunk(const Isochrone& iso, const Timetable& tt, size_t part, std::string& out);
@@ -0,0 +1,134 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+
+// Appends JSON to a caller-owned buffer, so a worker can keep one string
+// across responses. Separators are tracked per nesting level (up to 64), keys
+// and strings are escaped, and numbers go through to_chars.
+class JsonWriter {
+public:
+    explicit JsonWriter(std::string& out, std::size_t reserve = 0) : out(out) {
+        if (reserve) out.reserve(out.size() + reserve);
+    }
+
+    JsonWriter& begin_object() { return open('{'); }
+    JsonWriter& end_object() { return close('}'); }
+    JsonWriter& begin_array() { return open('['); }
+    JsonWriter& end_array() { return close(']'); }
+
+    JsonWriter& key(std::string_view k) {
+        sep();
+        quoted(k);
+        out += ':';
+        after_key = true;
+        return *this;
+    }
+
+    JsonWriter& value(std::string_view s) {
+        sep();
+        quoted(s);
+        return *this;
+    }
+    JsonWriter& value(const char* s) { return value(std::string_view(s)); }
+    JsonWriter& value(const std::string& s) { return value(std::string_view(s)); }
+    JsonWriter& value(long long v) {
+        sep();
+        char buf[24];
+        out.append(buf, std::to_chars(buf, buf + sizeof(buf), v).ptr);
+        return *this;
+    }
+    JsonWriter& value(int v) { return value(static_cast<long long>(v)); }
+    JsonWriter& value(std::size_t v) { return value(static_cast<long long>(v)); }
+    // Fixed-point with `decimals` digits, as coordinates and rates are printed.
+    JsonWriter& value(double v, int decimals = 6) {
+        sep();
+        char buf[48];
+        out.append(buf, std::to_chars(buf, buf + sizeof(buf), v, std::chars_format::fixed, decimals).ptr);
+        return *this;
+    }
+    JsonWriter& value(bool v) {
+        sep();
+        out += v ? "true" : "false";
+        return *this;
+    }
+    JsonWriter& null() {
+        sep();
+        out += "null";
+        return *this;
+    }
+    // An already serialised value, such as a row built by another worker.
+    JsonWriter& raw(std::string_view json) {
+        sep();
+        out += json;
+        return *this;
+    }
+
+    // For output split across buffers: writing continues inside an array or
+    // object opened by an earlier writer, after `written` elements.
+    JsonWriter& resume(bool written) {
+        ++depth;
+        set_first(!written);
+        return *this;
+    }
+
+private:
+    JsonWriter& open(char c) {
+        sep();
+        out += c;
+        ++depth;
+        set_first(true);
+        return *this;
+    }
+    JsonWriter& close(char c) {
+        --depth;
+        out += c;
+        return *this;
+    }
+    void set_first(bool f) {
+        std::uint64_t bit = std::uint64_t(1) << (depth & 63);
+        first = f ? first | bit : first & ~bit;
+    }
+    void sep() {
+        if (after_key) {
+            after_key = false;
+            return;
+        }
+        if (depth == 0) return;
+        std::uint64_t bit = std::uint64_t(1) << (depth & 63);
+        if (!(first & bit)) out += ',';
+        first &= ~bit;
+    }
+    // Runs of plain characters are appended whole.
+    void quoted(std::string_view s) {
+        out += '"';
+        std::size_t run = 0;
+        for (std::size_t i = 0; i < s.size(); ++i) {
+            unsigned char c = static_cast<unsigned char>(s[i]);
+            if (c >= 0x20 && c != '"' && c != '\\') continue;
+            out.append(s.data() + run, i - run);
+            run = i + 1;
+            switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default: {
+                char buf[8];
+                std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+                out += buf;
+            }
+            }
+        }
+        out.append(s.data() + run, s.size() - run);
+        out += '"';
+    }
+
+    std::string& out;
+    std::uint64_t first = 0; // bit d: nothing written yet at depth d
+    int depth = 0;
+    bool after_key = false;
+};
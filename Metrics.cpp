@@ -0,0 +1,119 @@
+#include <cstdio>
+#include <stdexcept>
+#include "Metrics.h"
+
+using namespace std;
+
+static string num(double v) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.9g", v);
+    return buf;
+}
+
+static string braces(const string& labels, const string& extra = "") {
+    if (labels.empty() && extra.empty()) return "";
+    return "{" + labels + (!labels.empty() && !extra.empty() ? "," : "") + extra + "}";
+}
+
+Metrics::Family& Metrics::family(const string& name, const string& help, const char* type) {
+    for (auto& f : families) {
+        if (f.name == name) return f;
+    }
+    families.push_back({ name, help, type, {} });
+    return families.back();
+}
+
+int Metrics::allocate(int n) {
+    if (n_slots + n > MAX_SLOTS) throw length_error("too many metric slots");
+    n_slots += n;
+    return n_slots - n;
+}
+
+Metrics::Id Metrics::counter(const string& name, const string& help, const string& labels) {
+    Series s;
+    s.labels = labels;
+    s.slot = allocate(1);
+    family(name, help, "counter").series.push_back(s);
+    return s.slot;
+}
+
+Metrics::Id Metrics::histogram(const string& name, const string& help, vector<uint64_t> bounds, double scale,
+    const string& labels) {
+    Series s;
+    s.labels = labels;
+    s.hist = static_cast<int>(hists.size());
+    hists.push_back({ allocate(static_cast<int>(bounds.size()) + 3), move(bounds), scale });
+    family(name, help, "histogram").series.push_back(s);
+    return s.hist;
+}
+
+void Metrics::gauge(const string& name, const string& help, function<double()> read, const string& labels) {
+    Series s;
+    s.labels = labels;
+    s.read = move(read);
+    family(name, help, "gauge").series.push_back(move(s));
+}
+
+void Metrics::counter(const string& name, const string& help, function<double()> read, const string& labels) {
+    Series s;
+    s.labels = labels;
+    s.read = move(read);
+    family(name, help, "counter").series.push_back(move(s));
+}
+
+void Metrics::observe(Id histogram, uint64_t v) {
+    const Hist& h = hists[histogram];
+    size_t b = 0;
+    while (b < h.bounds.size() && v > h.bounds[b]) ++b;
+    int n = static_cast<int>(h.bounds.size());
+    bump(h.slot + static_cast<int>(b), 1);
+    bump(h.slot + n + 1, v);
+    bump(h.slot + n + 2, 1);
+}
+
+Metrics::Shard& Metrics::local() {
+    thread_local const Metrics* owner = nullptr;
+    thread_local Shard* shard = nullptr;
+    if (owner != this) {
+        lock_guard<mutex> lk(mtx);
+        shards.push_back(make_unique<Shard>());
+        shard = shards.back().get();
+        owner = this;
+    }
+    return *shard;
+}
+
+uint64_t Metrics::total(int slot) const {
+    uint64_t sum = 0;
+    for (const auto& s : shards) sum += s->slots[slot].load(memory_order_relaxed);
+    return sum;
+}
+
+string Metrics::expose() const {
+    lock_guard<mutex> lk(mtx);
+    string out;
+    for (const auto& f : families) {
+        out += "# HELP " + f.name + " " + f.help + "\n# TYPE " + f.name + " " + f.type + "\n";
+        for (const auto& s : f.series) {
+            if (s.read) {
+                out += f.name + braces(s.labels) + " " + num(s.read()) + "\n";
+            }
+            else if (s.hist < 0) {
+                out += f.name + braces(s.labels) + " " + to_string(total(s.slot)) + "\n";
+            }
+            else {
+                const Hist& h = hists[s.hist];
+                int n = static_cast<int>(h.bounds.size());
+                uint64_t cum = 0;
+                for (int b = 0; b <= n; ++b) {
+                    cum += total(h.slot + b);
+                    string le = b < n ? num(h.bounds[b] / h.scale) : "+Inf";
+                    out += f.name + "_bucket" + braces(s.labels, "le=\"" + le + "\"") + " " + to_string(cum) + "\n";
+                }
+                out += f.name + "_sum" + braces(s.labels) + " " + num(total(h.slot + n + 1) / h.scale) + "\n";
+                out += f.name + "_count" + braces(s.labels) + " " + to_string(total(h.slot + n + 2)) + "\n";
+            }
+        }
+    }
+    return out;
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <cstdint>
+
+// Counters and histograms in the Prometheus text format. Every thread records
+// into its own shard of slots, which only it writes, so recording is a relaxed
+// load and store with no locking or shared cache lines; expose() sums the
+// shards. Series are registered at startup, before any thread records.
+class Metrics {
+public:
+    using Id = int;
+
+    // labels is the inside of the braces, e.g. endpoint="/calculate".
+    Id counter(const std::string& name, const std::string& help, const std::string& labels = "");
+    // Integer observations in units of 1/scale (microseconds for seconds with
+    // scale 1e6); bounds are bucket upper limits in the same units, ascending.
+    Id histogram(const std::string& name, const std::string& help, std::vector<std::uint64_t> bounds,
+        double scale = 1, const std::string& labels = "");
+    // Series kept elsewhere, read when scraped.
+    void gauge(const std::string& name, const std::string& help, std::function<double()> read,
+        const std::string& labels = "");
+    void counter(const std::string& name, const std::string& help, std::function<double()> read,
+        const std::string& labels = "");
+
+    void add(Id counter, std::uint64_t n = 1) { bump(counter, n); }
+    void observe(Id histogram, std::uint64_t v);
+
+    std::string expose() const;
+
+private:
+    static constexpr int MAX_SLOTS = 4096;
+    struct Shard {
+        std::atomic<std::uint64_t> slots[MAX_SLOTS];
+    };
+    struct Hist {
+        int slot; // one per bucket, then +Inf, sum and count
+        std::vector<std::uint64_t> bounds;
+        double scale;
+    };
+    struct Series {
+        std::string labels;
+        int slot = -1, hist = -1;
+        std::function<double()> read;
+    };
+    struct Family {
+        std::string name, help, type;
+        std::vector<Series> series;
+    };
+
+    Family& family(const std::string& name, const std::string& help, const char* type);
+    int allocate(int n);
+    Shard& local();
+    void bump(int slot, std::uint64_t n) {
+        auto& s = local().slots[slot];
+        s.store(s.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    std::uint64_t total(int slot) const;
+
+    std::vector<Family> families;
+    std::vector<Hist> hists;
+    int n_slots = 0;
+    mutable std::mutex mtx; // guards shards
+    std::vector<std::unique_ptr<Shard>> shards;
+};
@@ -0,0 +1,227 @@
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <algorithm>
+#include <bitset>
+#include <omp.h>
+#include "Partition.h"
+
+using namespace std;
+
+constexpr uint32_t PART_MAGIC = 0x54524150; // "PART"
+constexpr uint32_t PART_VERSION = 1;
+
+// Splits stations [lo, hi) into n cells numbered from first, halving along
+// the longer side of their bounding box.
+static void bisect(vector<pair<double, double>>& pos, vector<int>& order, int lo, int hi, int n, int first,
+    vector<int>& cell) {
+    if (n == 1 || hi - lo <= 1) {
+        for (int i = lo; i < hi; ++i) cell[order[i]] = first;
+        return;
+    }
+    double lat0 = 90, lat1 = -90, lon0 = 180, lon1 = -180;
+    for (int i = lo; i < hi; ++i) {
+        lat0 = min(lat0, pos[order[i]].first);
+        lat1 = max(lat1, pos[order[i]].first);
+        lon0 = min(lon0, pos[order[i]].second);
+        lon1 = max(lon1, pos[order[i]].second);
+    }
+    bool by_lat = lat1 - lat0 > (lon1 - lon0) * cos((lat0 + lat1) / 2 * M_PI / 180.0);
+    int left = n / 2, mid = lo + static_cast<int>(static_cast<long long>(hi - lo) * left / n);
+    nth_element(order.begin() + lo, order.begin() + mid, order.begin() + hi, [&](int a, int b) {
+        return by_lat ? pos[a].first < pos[b].first : pos[a].second < pos[b].second;
+        });
+    bisect(pos, order, lo, mid, left, first, cell);
+    bisect(pos, order, mid, hi, n - left, first + left, cell);
+}
+
+static void assign_cells(const Timetable& tt, int n_cells, Partition& part) {
+    vector<pair<double, double>> pos(tt.n_stations());
+    for (int st = 0; st < tt.n_stations(); ++st) {
+        const Stop& s = tt.stops.at(tt.station_stop[tt.station_first[st]]);
+        pos[st] = { s.lat, s.lon };
+    }
+    vector<int> order(tt.n_stations()), cell(tt.n_stations());
+    for (int st = 0; st < tt.n_stations(); ++st) order[st] = st;
+    bisect(pos, order, 0, tt.n_stations(), n_cells, 0, cell);
+
+    part.n_cells = n_cells;
+    part.words = (n_cells + 63) / 64;
+    part.cell_of.assign(tt.n_ids, -1);
+    for (int sid = 0; sid < tt.n_ids; ++sid) {
+        if (tt.station_of[sid] >= 0) part.cell_of[sid] = cell[tt.station_of[sid]];
+    }
+}
+
+static vector<int> border_stops(const Timetable& tt, const Partition& part) {
+    vector<char> border(tt.n_ids, 0);
+    auto link = [&](int a, int b) {
+        if (part.cell_of[a] >= 0 && part.cell_of[b] >= 0 && part.cell_of[a] != part.cell_of[b]) border[a] = border[b] = 1;
+    };
+    for (int t = 0; t < tt.n_trips(); ++t) {
+        for (int e = tt.trip_first[t]; e + 1 < tt.trip_first[t + 1]; ++e) link(tt.ev_sid[e], tt.ev_sid[e + 1]);
+    }
+    for (const auto& p : tt.transfers) {
+        for (const auto& x : p.second) link(x.u, x.v);
+    }
+    vector<int> out;
+    for (int sid = 0; sid < tt.n_ids; ++sid) {
+        if (border[sid]) out.push_back(sid);
+    }
+    return out;
+}
+
+bool build_partition(const Timetable& tt, int n_cells, int step_min, const string& path, PartitionStats& stats) {
+    auto t0 = chrono::steady_clock::now();
+    Partition part;
+    assign_cells(tt, max(1, n_cells), part);
+    vector<int> border = border_stops(tt, part);
+    vector<char> is_border(tt.n_ids, 0);
+    for (int sid : border) is_border[sid] = 1;
+
+    int first = INF_T, last = 0;
+    for (size_t e = 0; e < tt.ev_dep.size(); ++e) {
+        first = min(first, tt.ev_dep[e]);
+        last = max(last, tt.ev_dep[e]);
+    }
+    vector<int> deps;
+    for (int t = first; t <= last; t += max(1, step_min) * 60) deps.push_back(t);
+
+    int n = part.n_cells, w = part.words;
+    part.corridor.assign(static_cast<size_t>(n) * n * w, 0);
+    for (int c = 0; c < n; ++c) {
+        for (int d = 0; d < n; ++d) {
+            part.corridor[(static_cast<size_t>(c) * n + d) * w + c / 64] |= uint64_t(1) << (c % 64);
+            part.corridor[(static_cast<size_t>(c) * n + d) * w + d / 64] |= uint64_t(1) << (d % 64);
+        }
+    }
+    int finished = 0;
+
+#pragma omp parallel
+    {
+        QueryContext ctx;
+        ctx.reserve(tt);
+        vector<uint64_t> local(part.corridor.size(), 0), mask(w);
+#pragma omp for schedule(dynamic, 1)
+        for (int i = 0; i < static_cast<int>(border.size()); ++i) {
+            int src = border[i], a = part.cell_of[src];
+            for (int dep : deps) {
+                run_one_to_all(src, Time::from_secs(dep), tt, ctx);
+                for (int k = 1; k <= MAX_K; ++k) {
+                    for (int sid : ctx.touched[k]) {
+                        int b = part.cell_of[sid];
+                        if (!is_border[sid] || b == a) continue;
+                        int arr = arr_of(ctx.dp[k][sid]);
+                        bool pareto = true;
+                        for (int e = 0; e < k && pareto; ++e) pareto = arr_of(ctx.dp[e][sid]) > arr;
+                        if (!pareto) continue;
+
+                        fill(mask.begin(), mask.end(), 0);
+                        int s = sid, r = k;
+                        for (Label l = ctx.label(s, r); l.from != -1; l = ctx.label(s, r)) {
+                            int c = part.cell_of[s];
+                            if (c >= 0) mask[c / 64] |= uint64_t(1) << (c % 64);
+                            if (l.trip != -1) --r;
+                            s = l.from;
+                        }
+                        uint64_t* out = &local[(static_cast<size_t>(a) * n + b) * w];
+                        for (int x = 0; x < w; ++x) out[x] |= mask[x];
+                    }
+                }
+            }
+#pragma omp critical(part_progress)
+            if (++finished % 500 == 0) cout << "  " << finished << " / " << border.size() << " border stops" << endl;
+        }
+#pragma omp critical(part_merge)
+        for (size_t x = 0; x < local.size(); ++x) part.corridor[x] |= local[x];
+    }
+
+    ofstream out(path, ios::binary);
+    if (!out) return false;
+    uint32_t header[6] = { PART_MAGIC, PART_VERSION, static_cast<uint32_t>(tt.n_ids), static_cast<uint32_t>(n),
+        static_cast<uint32_t>(w), static_cast<uint32_t>(step_min) };
+    out.write(reinterpret_cast<const char*>(header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(part.cell_of.data()), part.cell_of.size() * sizeof(int));
+    out.write(reinterpret_cast<const char*>(part.corridor.data()), part.corridor.size() * sizeof(uint64_t));
+
+    size_t in_corridor = 0;
+    for (uint64_t m : part.corridor) in_corridor += bitset<64>(m).count();
+    stats.border = border.size();
+    stats.corridor_share = static_cast<double>(in_corridor) / (static_cast<double>(n) * n * n);
+    stats.secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+    return static_cast<bool>(out);
+}
+
+bool Partition::open(const string& path, const Timetable& tt) {
+    ifstream in(path, ios::binary);
+    uint32_t header[6];
+    if (!in.read(reinterpret_cast<char*>(header), sizeof(header))) return false;
+    if (header[0] != PART_MAGIC || header[1] != PART_VERSION || static_cast<int>(header[2]) != tt.n_ids) return false;
+    n_cells = static_cast<int>(header[3]);
+    words = static_cast<int>(header[4]);
+    cell_of.resize(tt.n_ids);
+    corridor.resize(static_cast<size_t>(n_cells) * n_cells * words);
+    in.read(reinterpret_cast<char*>(cell_of.data()), cell_of.size() * sizeof(int));
+    in.read(reinterpret_cast<char*>(corridor.data()), corridor.size() * sizeof(uint64_t));
+    if (!in || any_of(cell_of.begin(), cell_of.end(), [&](int c) { return c >= n_cells; })) n_cells = 0;
+
+    cell_first.assign(n_cells + 1, 0);
+    for (int c : cell_of) {
+        if (c >= 0 && loaded()) ++cell_first[c + 1];
+    }
+    for (int c = 0; c < n_cells; ++c) cell_first[c + 1] += cell_first[c];
+    cell_stop.resize(cell_first.back());
+    vector<int> fill(cell_first.begin(), cell_first.end() - 1);
+    for (int sid = 0; sid < tt.n_ids && loaded(); ++sid) {
+        if (cell_of[sid] >= 0) cell_stop[fill[cell_of[sid]]++] = sid;
+    }
+    return loaded();
+}
+
+bool run_partitioned(const vector<Seed>& seeds, const vector<Target>& targets, const Time& start_t,
+    const Timetable& tt, const Partition& part, QueryContext& ctx) {
+    auto& from = ctx.partition.from;
+    auto& to = ctx.partition.to;
+    auto& cells = ctx.partition.cells;
+    auto& region = ctx.partition.region;
+    int w = part.words;
+    from.assign(w, 0);
+    to.assign(w, 0);
+    for (const auto& s : seeds) {
+        int c = part.cell_of[s.sid];
+        if (c >= 0) from[c / 64] |= uint64_t(1) << (c % 64);
+    }
+    for (const auto& t : targets) {
+        int c = part.cell_of[t.sid];
+        if (c >= 0) to[c / 64] |= uint64_t(1) << (c % 64);
+    }
+    cells = from;
+    for (int x = 0; x < w; ++x) cells[x] |= to[x];
+    bool apart = false;
+    for (int a = 0; a < part.n_cells; ++a) {
+        if (!(from[a / 64] >> (a % 64) & 1)) continue;
+        for (int b = 0; b < part.n_cells; ++b) {
+            if (!(to[b / 64] >> (b % 64) & 1) || a == b) continue;
+            apart = true;
+            const uint64_t* m = part.cells(a, b);
+            for (int x = 0; x < w; ++x) cells[x] |= m[x];
+        }
+    }
+    if (!apart) return false;
+
+    // Only the stops of the chosen cells are marked, and unmarked afterwards,
+    // so a short query does not pay for the whole network.
+    if (static_cast<int>(region.size()) < tt.n_ids) region.assign(tt.n_ids, 0);
+    auto mark = [&](char in) {
+        for (int c = 0; c < part.n_cells; ++c) {
+            if (!(cells[c / 64] >> (c % 64) & 1)) continue;
+            for (int i = part.cell_first[c]; i < part.cell_first[c + 1]; ++i) region[part.cell_stop[i]] = in;
+        }
+    };
+    mark(1);
+    ctx.region = &region;
+    run_raptor(seeds, targets, start_t, tt, ctx);
+    ctx.region = nullptr;
+    mark(0);
+    return !ctx.profile.empty();
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include "Timetable.h"
+#include "Raptor.h"
+
+// Geographic partition for long-distance queries. Stations are split into
+// n_cells cells by recursive median bisection of their coordinates; border
+// stops are those with a trip hop or transfer into another cell. Offline, a
+// one-to-all search from every border stop at sampled departures records, per
+// pair of cells, which cells the optimal journeys between their border stops
+// change vehicles in: that corridor is the overlay a query is limited to.
+//
+// File: "PART", version, n_ids, n_cells, words, step (uint32 each); cell_of
+// (int32 [n_ids]); corridor masks (uint64 [n_cells * n_cells * words]).
+struct Partition {
+    int n_cells = 0;
+    int words = 0; // uint64 words per cell set
+    std::vector<int> cell_of; // by stop id, -1 for ids without a stop
+    std::vector<int> cell_first, cell_stop; // stops of cell c: cell_stop[cell_first[c] .. cell_first[c + 1])
+    std::vector<std::uint64_t> corridor; // cell set of (a, b) at (a * n_cells + b) * words
+
+    bool loaded() const { return n_cells > 0; }
+    const std::uint64_t* cells(int a, int b) const { return &corridor[(static_cast<std::size_t>(a) * n_cells + b) * words]; }
+    bool open(const std::string& path, const Timetable& tt);
+};
+
+struct PartitionStats {
+    double secs = 0;
+    std::size_t border = 0;
+    double corridor_share = 0; // mean fraction of cells in a corridor
+};
+
+bool build_partition(const Timetable& tt, int n_cells, int step_min, const std::string& path, PartitionStats& stats);
+
+// run_raptor with labels kept to the cells of the seeds and targets plus the
+// corridors between them. Returns false when both ends lie in one cell or the
+// restricted search finds nothing, for the caller to run a full search.
+bool run_partitioned(const std::vector<Seed>& seeds, const std::vector<Target>& targets, const Time& start_t,
+    const Timetable& tt, const Partition& part, QueryContext& ctx);
@@ -0,0 +1,62 @@
+#include <algorithm>
+#include <omp.h>
+#include "QueryPool.h"
+
+using namespace std;
+
+QueryPool::QueryPool(int workers, Mode mode, size_t max_queued)
+    : mode(mode), cores(omp_get_max_threads()), max_queued(max_queued) {
+    workers = max(1, workers);
+    for (int i = 0; i < workers; ++i) {
+        threads.emplace_back([this] {
+            QueryContext ctx;
+            work(ctx);
+        });
+    }
+}
+
+QueryPool::~QueryPool() {
+    {
+        lock_guard<mutex> lk(mtx);
+        stop = true;
+    }
+    cv.notify_all();
+    for (auto& t : threads) t.join();
+}
+
+void QueryPool::admit() {
+    lock_guard<mutex> lk(mtx);
+    if (max_queued && jobs.size() >= max_queued) throw Saturated();
+}
+
+void QueryPool::submit(function<void(QueryContext&)> job, bool bounded) {
+    {
+        lock_guard<mutex> lk(mtx);
+        if (bounded && max_queued && jobs.size() >= max_queued) throw Saturated();
+        jobs.push_back(move(job));
+    }
+    cv.notify_one();
+}
+
+void QueryPool::work(QueryContext& ctx) {
+    for (;;) {
+        function<void(QueryContext&)> job;
+        {
+            unique_lock<mutex> lk(mtx);
+            cv.wait(lk, [this] { return stop || !jobs.empty(); });
+            if (stop && jobs.empty()) return;
+            job = move(jobs.front());
+            jobs.pop_front();
+            ++busy;
+            // Queued work counts as load too, so a burst starts single-threaded.
+            int load = busy + static_cast<int>(jobs.size());
+            ctx.threads = mode == ADAPTIVE ? max(1, cores / load) : 1;
+            ctx.deadline = chrono::steady_clock::time_point::max();
+            ctx.trace = nullptr;
+        }
+        job(ctx);
+        lock_guard<mutex> lk(mtx);
+        --busy;
+    }
+}
+
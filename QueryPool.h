@@ -0,0 +1,65 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <utility>
+#include <memory>
+#include <stdexcept>
+#include "Raptor.h"
+
+// Fixed set of query workers, each owning a QueryContext. In THROUGHPUT mode
+// every query runs single-threaded; in ADAPTIVE mode a query may also use
+// OpenMP inside its rounds, with the cores split across the queries in flight.
+// With max_queued set, a query that would wait behind that many others is
+// refused with Saturated instead.
+class QueryPool {
+public:
+    enum Mode { THROUGHPUT, ADAPTIVE };
+
+    struct Saturated : std::runtime_error {
+        Saturated() : std::runtime_error("query queue full") {}
+    };
+
+    QueryPool(int workers, Mode mode, std::size_t max_queued = 0);
+    ~QueryPool();
+
+    // Queues f(ctx) for a worker; the future carries its result or exception.
+    // Unbounded submissions skip the queue limit, for requests that were
+    // admitted as a whole and keep their own tasks in check.
+    template <class F>
+    auto async(F f, bool bounded = true) -> std::future<decltype(f(std::declval<QueryContext&>()))> {
+        using R = decltype(f(std::declval<QueryContext&>()));
+        auto task = std::make_shared<std::packaged_task<R(QueryContext&)>>(std::move(f));
+        auto fut = task->get_future();
+        submit([task](QueryContext& ctx) { (*task)(ctx); }, bounded);
+        return fut;
+    }
+
+    // Runs f(ctx) on a worker and blocks until it returns.
+    template <class F>
+    auto run(F f) -> decltype(f(std::declval<QueryContext&>())) {
+        return async(std::move(f)).get();
+    }
+
+    // Throws Saturated if a bounded submission would be refused now.
+    void admit();
+
+private:
+    void submit(std::function<void(QueryContext&)> job, bool bounded);
+    void work(QueryContext& ctx);
+
+    Mode mode;
+    int cores;
+    std::size_t max_queued;
+    int busy = 0;
+    bool stop = false;
+    std::vector<std::thread> threads;
+    std::deque<std::function<void(QueryContext&)>> jobs;
+    std::mutex mtx;
+    std::condition_variable cv;
+};
+
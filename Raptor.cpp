@@ -4,166 +4,345 @@
 #include <algorithm>
 #include <omp.h>
 #include "Raptor.h"
+#include "ScanKernel.h"
 #include "DataTypes.h"
 
 using namespace std;
 
-constexpr double WALK_V = 1.4;
-constexpr double MAX_WALK = 1500;
-constexpr int MAX_K = 5;
-
-void merge(vector<Journey>& p, const Journey& nj) {
+void merge(vector<Label>& p, const Label& nj) {
     for (const auto& ej : p) {
         if (ej.arr <= nj.arr && ej.k <= nj.k) {
             return;
         }
     }
     p.erase(remove_if(p.begin(), p.end(),
-        [&](const Journey& ej) {
+        [&](const Label& ej) {
             return nj.arr <= ej.arr && nj.k <= ej.k;
         }),
         p.end());
     p.insert(lower_bound(p.begin(), p.end(), nj), nj);
 }
 
-void run_raptor(int src, int dest, const Time& start_t,
-    const robin_hood::unordered_map<int, Stop>& stops,
-    const robin_hood::unordered_map<int, vector<Transfer>>& transfers,
-    const robin_hood::unordered_map<string, vector<StopTime>>& trips,
-    const robin_hood::unordered_map<int, vector<string>>& routes_at_stop,
-    robin_hood::unordered_map<int, vector<Journey>>& profiles,
-    robin_hood::unordered_map<int, robin_hood::unordered_map<int, Journey>>& preds) {
+static bool relax(vector<Packed>& lbl, vector<int>& touched, int sid, Packed nj) {
+    Packed& cur = lbl[sid];
+    if (cur <= nj) return false;
+    // Walks must arrive strictly earlier: on a tie, a zero-length footpath could
+    // point the label back at the stop it came from.
+    if ((static_cast<uint32_t>(nj) & WALK) && arr_of(cur) == arr_of(nj)) return false;
+    if (cur == EMPTY_L) touched.push_back(sid);
+    cur = nj;
+    return true;
+}
 
-    vector<robin_hood::unordered_map<int, vector<Journey>>> dp(MAX_K + 1);
+bool settle(QueryContext& ctx, int k, int sid, Packed nj) {
+    int arr = arr_of(nj);
+    if (arr >= ctx.bound || (ctx.region && !(*ctx.region)[sid])) return false;
+    if (relax(ctx.dp[k], ctx.touched[k], sid, nj)) ++ctx.labels;
+    if (ctx.egress[sid] != INF_T) ctx.bound = min(ctx.bound, arr + ctx.egress[sid]);
+    return true;
+}
 
-    merge(dp[0][src], { start_t, start_t, 0, -1, "Start" });
-    const auto& src_stop = stops.at(src);
+static Journey to_journey(const Label& l, int start, const Timetable& tt) {
+    Journey j = { Time::from_secs(l.arr), Time::from_secs(start), l.k, l.from, "" };
+    if (l.from == -1) j.meth = "Start";
+    else if (l.trip != -1) j.meth = "Trip " + tt.trip_ids[l.trip];
+    else j.meth = "Walk";
+    return j;
+}
 
-    for (const auto& p : stops) {
-        double dist = haversine(src_stop.lat, src_stop.lon, p.second.lat, p.second.lon);
-        if (dist <= MAX_WALK && p.first != src) {
-            int walk_t = static_cast<int>(dist / WALK_V);
-            Journey j = { Time::from_secs(start_t.to_secs() + walk_t), start_t, 0, src, "Walk" };
-            merge(dp[0][p.first], j);
+void QueryContext::reserve(const Timetable& t) {
+    tt = &t;
+    if (n_ids < t.n_ids) {
+        n_ids = t.n_ids;
+        for (int k = 0; k <= MAX_K; ++k) {
+            dp[k].assign(n_ids, EMPTY_L);
+            touched[k].clear();
         }
+        q.reset(new atomic<Packed>[n_ids]);
+        for (int s = 0; s < n_ids; ++s) q[s].store(EMPTY_L, memory_order_relaxed);
+        q_touched.assign(omp_get_max_threads(), {});
+        egress.assign(n_ids, INF_T);
+        target_sids.clear();
     }
+    if (static_cast<int>(trip_start.size()) < t.n_trips()) {
+        trip_start.assign(t.n_trips(), INF_T);
+        queue.clear();
+    }
+}
 
-    if (transfers.count(src)) {
-        for (const auto& t : transfers.at(src)) {
-            Journey j = { Time::from_secs(start_t.to_secs() + t.dur), start_t, 0, src, "Walk" };
-            merge(dp[0][t.v], j);
-        }
+void QueryContext::reset() {
+    for (int k = 0; k <= MAX_K; ++k) {
+        for (int sid : touched[k]) dp[k][sid] = EMPTY_L;
+        touched[k].clear();
     }
+    for (int sid : target_sids) egress[sid] = INF_T;
+    target_sids.clear();
+    bound = INF_T;
+    partial = false;
+    rounds = scanned = labels = 0;
+    dest_prof.clear();
+    profile.clear();
+    profile_at.clear();
+}
 
-    for (int k = 1; k <= MAX_K; ++k) {
-        vector<int> marked;
-        marked.reserve(dp[k - 1].size());
-        for (const auto& p : dp[k - 1]) {
-            marked.push_back(p.first);
-        }
+Label QueryContext::label(int sid, int k) const {
+    Packed l = dp[k][sid];
+    uint32_t code = static_cast<uint32_t>(l);
+    if (code == START_CODE) return { arr_of(l), k, -1, -1 };
+    if (code & WALK) return { arr_of(l), k, static_cast<int>(code & ~WALK), -1 };
+    return { arr_of(l), k, tt->ev_sid[code], tt->ev_trip[code] };
+}
 
-        vector<robin_hood::unordered_map<int, vector<Journey>>> local_q(omp_get_max_threads());
+// The round-k label at sid belongs to the stop's Pareto set only if no label
+// from an earlier round arrives at least as early.
+static bool pareto_at(const QueryContext& ctx, int sid, int k) {
+    int arr = arr_of(ctx.dp[k][sid]);
+    if (arr == INF_T) return false;
+    for (int e = 0; e < k; ++e) {
+        if (arr_of(ctx.dp[e][sid]) <= arr) return false;
+    }
+    return true;
+}
 
-#pragma omp parallel for schedule(dynamic)
-        for (size_t i = 0; i < marked.size(); ++i) {
-            int sid = marked[i];
-            int tid = omp_get_thread_num();
+bool QueryContext::pred(int sid, int k, Journey& out) const {
+    if (k < 0 || k > MAX_K || sid < 0 || sid >= n_ids) return false;
+    // The round-k label is exactly the one a later label was built from.
+    if (dp[k][sid] == EMPTY_L) return false;
+    out = to_journey(label(sid, k), start, *tt);
+    return true;
+}
 
-            if (routes_at_stop.count(sid)) {
-                for (const auto& trip_id : routes_at_stop.at(sid)) {
-                    const auto& sched = trips.at(trip_id);
+void init_seeds(const vector<Seed>& seeds, const vector<Target>& targets, const Time& start_t,
+    QueryContext& ctx) {
+    ctx.reset();
+    ctx.start = start_t.to_secs();
+    for (const auto& t : targets) {
+        if (ctx.egress[t.sid] == INF_T) ctx.target_sids.push_back(t.sid);
+        ctx.egress[t.sid] = min(ctx.egress[t.sid], t.secs);
+    }
+    for (const auto& s : seeds) {
+        uint32_t code = s.from == -1 ? START_CODE : WALK | static_cast<uint32_t>(s.from);
+        settle(ctx, 0, s.sid, pack(ctx.start + s.secs, code));
+    }
+}
 
-                    int b_idx = -1;
-                    for (size_t j = 0; j < sched.size(); ++j) {
-                        if (sched[j].sid == sid) {
-                            b_idx = j;
-                            break;
-                        }
-                    }
+// run_rounds' hooks. The untraced instantiation has nothing to call, so the
+// counts gathered for it are dropped with them.
+struct NoTrace {
+    void begin(int) {}
+    void queued(int) {}
+    void scanned() {}
+    void merged(int) {}
+};
 
-                    if (b_idx != -1) {
-                        Journey best_j;
-                        best_j.from = -1;
-
-                        for (size_t j = b_idx; j < sched.size(); ++j) {
-                            const auto& st = sched[j];
-
-                            if (dp[k - 1].count(st.sid)) {
-                                for (const auto& pj : dp[k - 1].at(st.sid)) {
-                                    if (pj.arr <= st.dep) {
-                                        if (best_j.from == -1 || pj.arr < best_j.arr) {
-                                            best_j = pj;
-                                        }
-                                    }
-                                }
-                            }
-
-                            if (best_j.from != -1) {
-                                int p_id = (j > static_cast<size_t>(b_idx)) ? sched[j - 1].sid : best_j.from;
-                                Journey nj = { st.arr, best_j.dep, k, p_id, "Trip " + trip_id };
-                                merge(local_q[tid][st.sid], nj);
-                            }
-                        }
-                    }
-                }
+struct Tracer {
+    QueryTrace& out;
+    const QueryContext& ctx;
+    chrono::steady_clock::time_point t = {};
+    int labels = 0;
+
+    double lap() {
+        auto now = chrono::steady_clock::now();
+        double ms = chrono::duration<double, milli>(now - t).count();
+        t = now;
+        return ms;
+    }
+    void begin(int marked) {
+        out.rounds.push_back({ marked, 0, 0, 0, 0, 0, 0 });
+        labels = ctx.labels;
+        t = chrono::steady_clock::now();
+    }
+    void queued(int trips) {
+        out.rounds.back().trips = trips;
+        out.rounds.back().queue_ms = lap();
+    }
+    void scanned() { out.rounds.back().scan_ms = lap(); }
+    void merged(int stops) {
+        RoundTrace& r = out.rounds.back();
+        r.merged = stops;
+        r.improved = ctx.labels - labels;
+        r.merge_ms = lap();
+    }
+};
+
+template <class Trace>
+static void run_rounds(const Timetable& tt, QueryContext& ctx, Trace& trace) {
+    const ScanKernel& kern = scan_kernel();
+
+    for (int k = 1; k <= MAX_K && !ctx.out_of_time(); ++k) {
+        const auto& prev = ctx.dp[k - 1];
+        trace.begin(static_cast<int>(ctx.touched[k - 1].size()));
+
+        // Queue every trip through a stop labelled last round, from its earliest such stop.
+        for (int sid : ctx.touched[k - 1]) {
+            if (arr_of(prev[sid]) >= ctx.bound) continue;
+            for (int i = tt.stop_first[sid]; i < tt.stop_first[sid + 1]; ++i) {
+                int e = tt.stop_ev[i];
+                int& first = ctx.trip_start[tt.ev_trip[e]];
+                if (first == INF_T) ctx.queue.push_back(tt.ev_trip[e]);
+                first = min(first, e);
             }
         }
 
-        robin_hood::unordered_map<int, vector<Journey>> q;
-        for (const auto& lq : local_q) {
-            for (const auto& p : lq) {
-                for (const auto& j : p.second) {
-                    merge(q[p.first], j);
+        ++ctx.rounds;
+        ctx.scanned += static_cast<int>(ctx.queue.size());
+        trace.queued(static_cast<int>(ctx.queue.size()));
+
+        // Each trip is scanned by one thread, which boards at the first stop where
+        // last round's label makes the departure and publishes every later arrival
+        // straight into the shared round array. Past the deadline the remaining
+        // trips are only dequeued; what was published still gets settled.
+        atomic<bool> late(false);
+#pragma omp parallel num_threads(ctx.threads) if(ctx.threads > 1)
+        {
+            auto& lt = ctx.q_touched[omp_get_thread_num()];
+#pragma omp for schedule(dynamic, 16)
+            for (size_t i = 0; i < ctx.queue.size(); ++i) {
+                int t = ctx.queue[i];
+                int e = ctx.trip_start[t];
+                int end = tt.trip_first[t + 1];
+                ctx.trip_start[t] = INF_T;
+                if (late.load(memory_order_relaxed)) continue;
+                if ((i & 255) == 255 && ctx.past_deadline()) {
+                    late.store(true, memory_order_relaxed);
+                    continue;
+                }
+
+                int board = kern.board(tt.ev_sid.data(), tt.ev_dep.data(), e, end, prev.data());
+                if (board < end) {
+                    kern.alight(tt.ev_sid.data(), tt.ev_arr.data(), board + 1, end,
+                        static_cast<uint32_t>(board), ctx.q.get(), lt);
                 }
             }
         }
+        ctx.queue.clear();
+        if (late.load(memory_order_relaxed)) ctx.partial = true;
+        trace.scanned();
 
-        for (const auto& p : q) {
-            for (const auto& j : p.second) {
-                merge(dp[k][p.first], j);
-                if (transfers.count(p.first)) {
-                    for (const auto& t : transfers.at(p.first)) {
-                        Journey tj = { Time::from_secs(j.arr.to_secs() + t.dur), j.dep, j.k, p.first, "Walk" };
-                        merge(dp[k][t.v], tj);
+        int merged = 0;
+        for (auto& lt : ctx.q_touched) {
+            merged += static_cast<int>(lt.size());
+            for (int sid : lt) {
+                Packed j = ctx.q[sid].load(memory_order_relaxed);
+                ctx.q[sid].store(EMPTY_L, memory_order_relaxed);
+                // Walks out of a stop the region drops would point back at a
+                // stop with no round-k label.
+                if (!settle(ctx, k, sid, j)) continue;
+                auto tit = tt.transfers.find(sid);
+                if (tit != tt.transfers.end()) {
+                    for (const auto& t : tit->second) {
+                        settle(ctx, k, t.v, pack(arr_of(j) + t.dur, WALK | sid));
                     }
                 }
             }
+            lt.clear();
         }
+        trace.merged(merged);
     }
+}
 
-    robin_hood::unordered_map<int, vector<Journey>> res;
-    for (int k = 0; k <= MAX_K; ++k) {
-        for (const auto& p : dp[k]) {
-            for (const auto& j : p.second) {
-                merge(res[p.first], j);
-            }
+int QueryContext::arrival(int sid) const {
+    int best = INF_T;
+    for (int k = 0; k <= MAX_K; ++k) best = min(best, arr_of(dp[k][sid]));
+    for (int i = tt->walk_first[sid]; i < tt->walk_first[sid + 1]; ++i) {
+        int o = tt->walk_to[i];
+        for (int k = 0; k <= MAX_K; ++k) {
+            int a = arr_of(dp[k][o]);
+            if (a != INF_T) best = min(best, a + tt->walk_dur[i]);
         }
     }
+    return best;
+}
 
-    const auto& dest_stop = stops.at(dest);
-    for (const auto& p : res) {
-        if (p.first == dest) continue;
-        const auto& curr_stop = stops.at(p.first);
-        double dist = haversine(curr_stop.lat, curr_stop.lon, dest_stop.lat, dest_stop.lon);
-        if (dist <= MAX_WALK) {
-            int walk_t = static_cast<int>(dist / WALK_V);
-            for (const auto& j : p.second) {
-                Journey fw = { Time::from_secs(j.arr.to_secs() + walk_t), j.dep, j.k, p.first, "Walk" };
-                merge(profiles[dest], fw);
-            }
+void run_one_to_all(int src, const Time& start_t, const Timetable& tt, QueryContext& ctx) {
+    vector<Seed> seeds;
+    stop_access({ src }, tt, seeds);
+    init_seeds(seeds, {}, start_t, ctx);
+    NoTrace off;
+    run_rounds(tt, ctx, off);
+}
+
+void run_raptor(int src, int dest, const Time& start_t, const Timetable& tt, QueryContext& ctx) {
+    vector<Seed> seeds;
+    vector<Target> targets;
+    stop_access({ src }, tt, seeds);
+    stop_egress({ dest }, tt, targets);
+    run_raptor(seeds, targets, start_t, tt, ctx);
+}
+
+void run_raptor(const vector<Seed>& seeds, const vector<Target>& targets, const Time& start_t,
+    const Timetable& tt, QueryContext& ctx) {
+    init_seeds(seeds, targets, start_t, ctx);
+    if (ctx.trace) {
+        Tracer on = { *ctx.trace, ctx };
+        run_rounds(tt, ctx, on);
+    }
+    else {
+        NoTrace off;
+        run_rounds(tt, ctx, off);
+    }
+    collect_profile(targets, tt, ctx);
+}
+
+void collect_profile(const vector<Target>& targets, const Timetable& tt, QueryContext& ctx) {
+    for (const auto& t : targets) {
+        for (int k = 0; k <= MAX_K; ++k) {
+            if (!pareto_at(ctx, t.sid, k)) continue;
+            Label l = ctx.label(t.sid, k);
+            if (t.secs == 0) l.at = t.sid;
+            else l = { l.arr + t.secs, k, t.sid, -1 };
+            merge(ctx.dest_prof, l);
         }
     }
 
-    for (const auto& p : res) {
-        for (const auto& j : p.second) {
-            merge(profiles[p.first], j);
+    for (const auto& l : ctx.dest_prof) {
+        ctx.profile.push_back(to_journey(l, ctx.start, tt));
+        ctx.profile_at.push_back(l.at);
+    }
+}
+
+// Keeps the quickest entry per stop from out[from ..], the earliest pushed on
+// ties, so the platforms of one station don't each add the same neighbours.
+template <class T>
+static void keep_quickest(vector<T>& out, size_t from) {
+    stable_sort(out.begin() + from, out.end(), [](const T& a, const T& b) { return a.sid != b.sid ? a.sid < b.sid : a.secs < b.secs; });
+    out.erase(unique(out.begin() + from, out.end(), [](const T& a, const T& b) { return a.sid == b.sid; }), out.end());
+}
+
+void stop_access(const vector<int>& sids, const Timetable& tt, vector<Seed>& out) {
+    size_t from = out.size();
+    for (int sid : sids) out.push_back({ sid, 0, -1 });
+    for (int sid : sids) {
+        for (int i = tt.walk_first[sid]; i < tt.walk_first[sid + 1]; ++i) {
+            out.push_back({ tt.walk_to[i], tt.walk_dur[i], sid });
+        }
+        auto tr = tt.transfers.find(sid);
+        if (tr != tt.transfers.end()) {
+            for (const auto& t : tr->second) out.push_back({ t.v, t.dur, sid });
         }
     }
+    keep_quickest(out, from);
+}
 
-    for (const auto& p : profiles) {
-        for (const auto& j : p.second) {
-            preds[p.first][j.k] = j;
+void point_access(double lat, double lon, const Timetable& tt, vector<Seed>& out) {
+    vector<pair<int, int>> near;
+    stops_near(tt, lat, lon, MAX_WALK, near);
+    for (const auto& p : near) out.push_back({ p.first, p.second, -1 });
+}
+
+void stop_egress(const vector<int>& sids, const Timetable& tt, vector<Target>& out) {
+    size_t from = out.size();
+    for (int sid : sids) out.push_back({ sid, 0 });
+    for (int sid : sids) {
+        for (int i = tt.walk_first[sid]; i < tt.walk_first[sid + 1]; ++i) {
+            out.push_back({ tt.walk_to[i], tt.walk_dur[i] });
         }
     }
+    keep_quickest(out, from);
 }
 
+void point_egress(double lat, double lon, const Timetable& tt, vector<Target>& out) {
+    vector<pair<int, int>> near;
+    stops_near(tt, lat, lon, MAX_WALK, near);
+    for (const auto& p : near) out.push_back({ p.first, p.second });
+}
@@ -1,14 +1,174 @@
 #pragma once
 #include <vector>
 #include <string>
+#include <utility>
+#include <atomic>
+#include <memory>
+#include <limits>
+#include <chrono>
+#include <cstdint>
 #include "DataTypes.h"
-#include "robin_hood.h"
+#include "Timetable.h"
 
-void run_raptor(int src, int dest, const Time& start_t,
-    const robin_hood::unordered_map<int, Stop>& stops,
-    const robin_hood::unordered_map<int, std::vector<Transfer>>& transfers,
-    const robin_hood::unordered_map<std::string, std::vector<StopTime>>& trips,
-    const robin_hood::unordered_map<int, std::vector<std::string>>& routes_at_stop,
-    robin_hood::unordered_map<int, std::vector<Journey>>& profiles,
-    robin_hood::unordered_map<int, robin_hood::unordered_map<int, Journey>>& preds);
+constexpr int MAX_K = 5;
+constexpr int INF_T = std::numeric_limits<int>::max();
 
+// Round labels are packed as (arrival << 32) | code, so the smaller word is the
+// better label and concurrent scans can publish with an atomic min. code is the
+// boarding event for trip labels, WALK | stop for walks, or START_CODE.
+using Packed = std::uint64_t;
+constexpr Packed EMPTY_L = ~Packed(0);
+constexpr std::uint32_t WALK = 1u << 31;
+constexpr std::uint32_t START_CODE = ~std::uint32_t(0);
+
+inline Packed pack(int arr, std::uint32_t code) { return (Packed(std::uint32_t(arr)) << 32) | code; }
+inline int arr_of(Packed l) { return l == EMPTY_L ? INF_T : static_cast<int>(l >> 32); }
+
+struct Label {
+    int arr, k, from;
+    int trip; // -1 for walks and the start label
+    int at = -1; // destination labels: the target stop reached, -1 after an egress walk
+    bool operator<(const Label& other) const {
+        if (arr != other.arr)
+            return arr < other.arr;
+        return k < other.k;
+    }
+};
+
+// Search entry: stop sid is reached secs after departure, on foot from stop
+// `from`, or directly from the query origin when from is -1 (a walk from a
+// point, another platform of the origin station, a drive to a park-and-ride).
+struct Seed {
+    int sid, secs, from;
+};
+
+// Search exit: the destination is secs on foot from stop sid. A zero-second
+// target is the destination stop itself.
+struct Target {
+    int sid, secs;
+};
+
+// Where a RAPTOR round's time went: queueing the trips of the stops marked
+// last round, scanning them, and merging the per-thread arrivals into the
+// round's labels along with their transfers.
+struct RoundTrace {
+    int marked, trips, merged, improved; // improved: labels stored this round
+    double queue_ms, scan_ms, merge_ms;
+};
+
+struct QueryTrace {
+    double access_ms = 0, search_ms = 0; // kept by the caller
+    std::vector<RoundTrace> rounds; // empty unless RAPTOR ran
+};
+
+// Working storage of the engines other than RAPTOR, kept in the context so a
+// search reuses it on whichever thread runs it. Arrays indexed by stop or trip
+// are sized on first use and left clean by each search through its own lists.
+struct TripBasedScratch {
+    std::vector<int> reached, reached_list; // first stop reached on each queued trip
+    std::vector<std::pair<int, int>> cur, next; // trip segments of this round and the next
+    std::vector<char> walk_in; // stops with a transfer walk into a target
+};
+
+// One source's transfer patterns as TransferPatterns::decode() lays them out.
+struct PatternTree {
+    std::vector<std::uint32_t> stop, parent; // stop | WALK when reached on foot
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> ends; // (target, node)
+};
+
+struct PatternScratch {
+    std::vector<PatternTree> trees; // one per origin seed
+    std::vector<std::vector<int>> arr; // per tree node
+    std::vector<std::pair<int, std::uint32_t>> level[MAX_K + 1]; // (tree, node) settled in each round
+    std::vector<char> need; // nodes on a pattern to some target
+    std::vector<int> rounds; // trips taken to reach each node
+};
+
+struct CsaScratch {
+    std::vector<Packed> lab; // one label per stop, packed like the round labels
+    std::vector<int> board; // boarding event of each trip entered, -1 if not
+    std::vector<int> lab_dirty, board_dirty;
+    std::vector<std::pair<int, Packed>> legs; // the journey found, from the destination back
+};
+
+struct PartitionScratch {
+    std::vector<std::uint64_t> from, to, cells; // cell sets of the seeds, the targets and the search
+    std::vector<char> region; // what ctx.region points at
+};
+
+// Reusable per-worker label storage. Arrays are indexed by stop id and are
+// reset through the touched lists, so a warm context allocates nothing.
+struct QueryContext {
+    std::vector<Packed> dp[MAX_K + 1];
+    std::vector<int> touched[MAX_K + 1];
+    std::unique_ptr<std::atomic<Packed>[]> q; // trip arrivals of the current round
+    std::vector<std::vector<int>> q_touched; // per OpenMP thread
+    std::vector<int> trip_start; // earliest marked event of each queued trip
+    std::vector<int> queue;
+    std::vector<int> egress; // seconds from each stop to the destination, INF_T if not a target
+    std::vector<int> target_sids;
+    int bound = INF_T; // best egress-adjusted arrival so far; later labels can't improve on it
+    std::vector<Label> dest_prof;
+    std::vector<Journey> profile; // Pareto set at dest, by arrival then trips
+    std::vector<int> profile_at; // per journey: Label::at
+    const Timetable* tt = nullptr;
+    int n_ids = 0;
+    int start = 0;
+    int threads = 1; // OpenMP threads a round may use
+    const std::vector<char>* region = nullptr; // when set, only stops marked here get labels
+    // Searches stop between rounds, and RAPTOR, Trip-Based and CSA within a
+    // scan, once this has passed; the results are then the best found so far and partial is set.
+    // QueryPool clears it before each job.
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+    bool partial = false;
+    // Work done by the last search: rounds run, trips (or Trip-Based segments,
+    // or CSA connections) scanned, labels stored.
+    int rounds = 0, scanned = 0, labels = 0;
+    // When set, run_raptor records its rounds here. QueryPool clears it before
+    // each job.
+    QueryTrace* trace = nullptr;
+    TripBasedScratch trip_based;
+    PatternScratch patterns;
+    CsaScratch csa;
+    PartitionScratch partition;
+
+    void reserve(const Timetable& tt);
+    void reset();
+    bool past_deadline() const { return std::chrono::steady_clock::now() >= deadline; }
+    // past_deadline() for the serial parts of a search: marks the results partial.
+    bool out_of_time() { return partial = partial || past_deadline(); }
+    Label label(int sid, int k) const;
+    // Earliest arrival at sid over all rounds, including a final walk; INF_T if unreached.
+    int arrival(int sid) const;
+    bool pred(int sid, int k, Journey& out) const;
+};
+
+void run_raptor(int src, int dest, const Time& start_t, const Timetable& tt, QueryContext& ctx);
+
+// Multi-source, multi-target form: every seed starts in round 0 and the profile
+// is the Pareto set over all targets with their egress walks added. Labels no
+// earlier than the best egress-adjusted arrival found so far are pruned.
+void run_raptor(const std::vector<Seed>& seeds, const std::vector<Target>& targets, const Time& start_t,
+    const Timetable& tt, QueryContext& ctx);
+
+// Access and egress sets: each stop contributes itself plus its footpaths (and,
+// on the way in, its transfers); a point contributes every stop within MAX_WALK.
+void stop_access(const std::vector<int>& sids, const Timetable& tt, std::vector<Seed>& out);
+void point_access(double lat, double lon, const Timetable& tt, std::vector<Seed>& out);
+void stop_egress(const std::vector<int>& sids, const Timetable& tt, std::vector<Target>& out);
+void point_egress(double lat, double lon, const Timetable& tt, std::vector<Target>& out);
+
+// Same search without a destination; read the results with ctx.arrival().
+void run_one_to_all(int src, const Time& start_t, const Timetable& tt, QueryContext& ctx);
+
+// Building blocks for other engines that fill the same round labels, so that
+// pred() and the profile work unchanged on their results.
+// Round 0: marks the targets, then stores every seed.
+void init_seeds(const std::vector<Seed>& seeds, const std::vector<Target>& targets, const Time& start_t,
+    QueryContext& ctx);
+// Stores a round-k label unless the destination bound already beats it or sid
+// is outside ctx.region, and tightens the bound when sid is a target. Returns
+// false when the label was dropped for either reason.
+bool settle(QueryContext& ctx, int k, int sid, Packed nj);
+// Pareto set over the targets' labels, egress walks added, into ctx.profile.
+void collect_profile(const std::vector<Target>& targets, const Timetable& tt, QueryContext& ctx);
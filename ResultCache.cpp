@@ -0,0 +1,62 @@
+#include <functional>
+#include <algorithm>
+#include "ResultCache.h"
+
+using namespace std;
+
+ResultCache::ResultCache(size_t capacity, int n) {
+    n = max(1, n);
+    per_shard = (capacity + n - 1) / n;
+    for (int i = 0; i < n; ++i) shards.emplace_back(new Shard);
+}
+
+ResultCache::Shard& ResultCache::shard_of(const string& key) {
+    return *shards[hash<string>()(key) % shards.size()];
+}
+
+bool ResultCache::get(const string& key, string& out) {
+    if (!enabled()) return false;
+    Shard& s = shard_of(key);
+    {
+        lock_guard<mutex> lk(s.mtx);
+        auto it = s.index.find(key);
+        if (it != s.index.end()) {
+            if (it->second->generation == generation.load(memory_order_relaxed)) {
+                s.lru.splice(s.lru.begin(), s.lru, it->second);
+                out = it->second->value;
+                n_hits.fetch_add(1, memory_order_relaxed);
+                return true;
+            }
+            s.lru.erase(it->second);
+            s.index.erase(it);
+        }
+    }
+    n_misses.fetch_add(1, memory_order_relaxed);
+    return false;
+}
+
+void ResultCache::put(const string& key, string value) {
+    if (!enabled()) return;
+    Shard& s = shard_of(key);
+    lock_guard<mutex> lk(s.mtx);
+    auto it = s.index.find(key);
+    if (it != s.index.end()) {
+        s.lru.erase(it->second);
+        s.index.erase(it);
+    }
+    s.lru.push_front({ key, move(value), generation.load(memory_order_relaxed) });
+    s.index[key] = s.lru.begin();
+    if (s.lru.size() > per_shard) {
+        s.index.erase(s.lru.back().key);
+        s.lru.pop_back();
+    }
+}
+
+size_t ResultCache::size() const {
+    size_t n = 0;
+    for (const auto& s : shards) {
+        lock_guard<mutex> lk(s->mtx);
+        n += s->lru.size();
+    }
+    return n;
+}
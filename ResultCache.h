@@ -0,0 +1,47 @@
+#pragma once
+#include <string>
+#include <list>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+#include "robin_hood.h"
+
+// Serialised responses by query key, in front of the search. Keys hash to one
+// of several shards, each an LRU list under its own lock, so workers looking
+// up different pairs rarely contend. Entries remember the generation they were
+// stored in; invalidate() starts a new one, which turns every older entry into
+// a miss, and must be called whenever the timetable is replaced.
+class ResultCache {
+public:
+    ResultCache(std::size_t capacity, int shards);
+
+    bool enabled() const { return per_shard > 0; }
+    bool get(const std::string& key, std::string& out);
+    void put(const std::string& key, std::string value);
+    void invalidate() { ++generation; }
+
+    std::uint64_t hits() const { return n_hits.load(std::memory_order_relaxed); }
+    std::uint64_t misses() const { return n_misses.load(std::memory_order_relaxed); }
+    std::size_t size() const;
+
+private:
+    struct Entry {
+        std::string key, value;
+        std::uint64_t generation;
+    };
+    struct Shard {
+        mutable std::mutex mtx;
+        std::list<Entry> lru; // most recently used first
+        robin_hood::unordered_map<std::string, std::list<Entry>::iterator> index;
+    };
+
+    Shard& shard_of(const std::string& key);
+
+    std::size_t per_shard;
+    std::vector<std::unique_ptr<Shard>> shards;
+    std::atomic<std::uint64_t> generation{ 0 }, n_hits{ 0 }, n_misses{ 0 };
+};
@@ -0,0 +1,164 @@
+#include <cstdlib>
+#include <cstring>
+#include "ScanKernel.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SCAN_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define SCAN_TARGET(isa) __attribute__((target(isa)))
+#else
+#define SCAN_TARGET(isa)
+#endif
+
+using namespace std;
+
+static_assert(sizeof(atomic<Packed>) == sizeof(Packed), "gathers read q as plain words");
+
+static int board_scalar(const int* sid, const int* dep, int e, int end, const Packed* prev) {
+    while (e < end && prev[sid[e]] >= pack(dep[e] + 1, 0)) ++e;
+    return e;
+}
+
+static void alight_scalar(const int* sid, const int* arr, int e, int end, uint32_t board,
+    atomic<Packed>* q, vector<int>& touched) {
+    for (; e < end; ++e) {
+        if (atomic_min(q[sid[e]], pack(arr[e], board))) touched.push_back(sid[e]);
+    }
+}
+
+#ifdef SCAN_X86
+
+static inline int lowest_bit(unsigned m) {
+#ifdef _MSC_VER
+    unsigned long i;
+    _BitScanForward(&i, m);
+    return static_cast<int>(i);
+#else
+    return __builtin_ctz(m);
+#endif
+}
+
+// The arrival half of a packed label is its high dword; an empty label reads
+// as 0xFFFFFFFF, so unsigned compares need no special case.
+static inline const int* arr_words(const void* labels) {
+    return reinterpret_cast<const int*>(labels) + 1;
+}
+
+SCAN_TARGET("avx2")
+static int board_avx2(const int* sid, const int* dep, int e, int end, const Packed* prev) {
+    const int* base = arr_words(prev);
+    for (; e + 8 <= end; e += 8) {
+        __m256i idx = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(sid + e));
+        __m256i a = _mm256_i32gather_epi32(base, idx, 8);
+        __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dep + e));
+        __m256i ok = _mm256_cmpeq_epi32(_mm256_max_epu32(a, d), d);
+        int m = _mm256_movemask_ps(_mm256_castsi256_ps(ok));
+        if (m) return e + lowest_bit(m);
+    }
+    return board_scalar(sid, dep, e, end, prev);
+}
+
+SCAN_TARGET("avx2")
+static void alight_avx2(const int* sid, const int* arr, int e, int end, uint32_t board,
+    atomic<Packed>* q, vector<int>& touched) {
+    const int* base = arr_words(q);
+    for (; e + 8 <= end; e += 8) {
+        __m256i idx = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(sid + e));
+        __m256i cur = _mm256_i32gather_epi32(base, idx, 8);
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(arr + e));
+        // Ties still go to the CAS, which breaks them on the boarding event.
+        __m256i ok = _mm256_cmpeq_epi32(_mm256_max_epu32(a, cur), cur);
+        unsigned m = static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(ok)));
+        while (m) {
+            int j = e + lowest_bit(m);
+            m &= m - 1;
+            if (atomic_min(q[sid[j]], pack(arr[j], board))) touched.push_back(sid[j]);
+        }
+    }
+    alight_scalar(sid, arr, e, end, board, q, touched);
+}
+
+SCAN_TARGET("sse4.1")
+static int board_sse(const int* sid, const int* dep, int e, int end, const Packed* prev) {
+    const int* base = arr_words(prev);
+    for (; e + 4 <= end; e += 4) {
+        __m128i a = _mm_set_epi32(base[2 * sid[e + 3]], base[2 * sid[e + 2]],
+            base[2 * sid[e + 1]], base[2 * sid[e]]);
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dep + e));
+        __m128i ok = _mm_cmpeq_epi32(_mm_max_epu32(a, d), d);
+        int m = _mm_movemask_ps(_mm_castsi128_ps(ok));
+        if (m) return e + lowest_bit(m);
+    }
+    return board_scalar(sid, dep, e, end, prev);
+}
+
+SCAN_TARGET("sse4.1")
+static void alight_sse(const int* sid, const int* arr, int e, int end, uint32_t board,
+    atomic<Packed>* q, vector<int>& touched) {
+    const int* base = arr_words(q);
+    for (; e + 4 <= end; e += 4) {
+        __m128i cur = _mm_set_epi32(base[2 * sid[e + 3]], base[2 * sid[e + 2]],
+            base[2 * sid[e + 1]], base[2 * sid[e]]);
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(arr + e));
+        __m128i ok = _mm_cmpeq_epi32(_mm_max_epu32(a, cur), cur);
+        unsigned m = static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(ok)));
+        while (m) {
+            int j = e + lowest_bit(m);
+            m &= m - 1;
+            if (atomic_min(q[sid[j]], pack(arr[j], board))) touched.push_back(sid[j]);
+        }
+    }
+    alight_scalar(sid, arr, e, end, board, q, touched);
+}
+
+static void cpu_features(bool& avx2, bool& sse41) {
+#ifdef _MSC_VER
+    int r[4];
+    __cpuid(r, 1);
+    sse41 = (r[2] & (1 << 19)) != 0;
+    bool os_avx = (r[2] & (1 << 27)) && (r[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+    __cpuid(r, 0);
+    avx2 = false;
+    if (os_avx && r[0] >= 7) {
+        __cpuidex(r, 7, 0);
+        avx2 = (r[1] & (1 << 5)) != 0;
+    }
+#else
+    __builtin_cpu_init();
+    avx2 = __builtin_cpu_supports("avx2");
+    sse41 = __builtin_cpu_supports("sse4.1");
+#endif
+}
+
+#endif
+
+static const ScanKernel SCALAR = { "scalar", board_scalar, alight_scalar };
+
+static ScanKernel pick_kernel() {
+#ifdef SCAN_X86
+    const ScanKernel avx2_k = { "avx2", board_avx2, alight_avx2 };
+    const ScanKernel sse_k = { "sse4.1", board_sse, alight_sse };
+    bool avx2 = false, sse41 = false;
+    cpu_features(avx2, sse41);
+    const char* force = getenv("CHRON_SCAN_KERNEL");
+    if (force) {
+        if (strcmp(force, "avx2") == 0 && avx2) return avx2_k;
+        if (strcmp(force, "sse4.1") == 0 && sse41) return sse_k;
+        if (strcmp(force, "scalar") == 0) return SCALAR;
+    }
+    if (avx2) return avx2_k;
+    if (sse41) return sse_k;
+#endif
+    return SCALAR;
+}
+
+const ScanKernel& scan_kernel() {
+    static const ScanKernel k = pick_kernel();
+    return k;
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include "Raptor.h"
+
+// Lowers a to v if v is smaller; true only for the one caller that filled an empty slot.
+inline bool atomic_min(std::atomic<Packed>& a, Packed v) {
+    Packed cur = a.load(std::memory_order_relaxed);
+    while (v < cur) {
+        if (a.compare_exchange_weak(cur, v, std::memory_order_relaxed)) return cur == EMPTY_L;
+    }
+    return false;
+}
+
+// Trip traversal over the flat event arrays. Each implementation handles a
+// block of stops per step and falls back to scalar code for the tail.
+struct ScanKernel {
+    const char* name;
+    // First event in [e, end) whose departure the label in prev at its stop makes, or end.
+    int (*board)(const int* sid, const int* dep, int e, int end, const Packed* prev);
+    // Publishes the arrivals of events [e, end) reached from event `board` into q,
+    // recording in touched every stop this call filled for the first time.
+    void (*alight)(const int* sid, const int* arr, int e, int end, std::uint32_t board,
+        std::atomic<Packed>* q, std::vector<int>& touched);
+};
+
+// Picked once from the CPU's features; CHRON_SCAN_KERNEL=avx2|sse4.1|scalar
+// forces a specific one.
+const ScanKernel& scan_kernel();
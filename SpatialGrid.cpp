@@ -0,0 +1,38 @@
+#include "SpatialGrid.h"
+
+using namespace std;
+
+void SpatialGrid::build(const robin_hood::unordered_map<int, Stop>& stops, double cell_m) {
+    cell_first.clear();
+    cell_stop.clear();
+    nx = ny = 0;
+    if (stops.empty()) return;
+
+    double lat1 = -90, lon1 = -180, lat_sum = 0;
+    lat0 = 90;
+    lon0 = 180;
+    for (const auto& p : stops) {
+        lat0 = min(lat0, p.second.lat);
+        lon0 = min(lon0, p.second.lon);
+        lat1 = max(lat1, p.second.lat);
+        lon1 = max(lon1, p.second.lon);
+        lat_sum += p.second.lat;
+    }
+    double mid = lat_sum / stops.size();
+    dlat = cell_m / 111320.0;
+    dlon = dlat / max(0.01, cos(mid * M_PI / 180.0));
+    // Stray coordinates (0,0 rows and the like) must not blow the grid up.
+    while ((lon1 - lon0) / dlon * (lat1 - lat0) / dlat > 4e6) {
+        dlat *= 2;
+        dlon *= 2;
+    }
+    nx = static_cast<int>((lon1 - lon0) / dlon) + 1;
+    ny = static_cast<int>((lat1 - lat0) / dlat) + 1;
+
+    cell_first.assign(nx * ny + 1, 0);
+    for (const auto& p : stops) ++cell_first[cell_y(p.second.lat) * nx + cell_x(p.second.lon) + 1];
+    for (int c = 0; c < nx * ny; ++c) cell_first[c + 1] += cell_first[c];
+    cell_stop.resize(stops.size());
+    vector<int> fill(cell_first.begin(), cell_first.end() - 1);
+    for (const auto& p : stops) cell_stop[fill[cell_y(p.second.lat) * nx + cell_x(p.second.lon)]++] = p.first;
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include "DataTypes.h"
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include "robin_hood.h"
+
+// Uniform lat/lon buckets of stop ids. Cells are roughly cell_m metres on a
+// side around the feed's mean latitude, so a radius search only visits the
+// few cells the circle overlaps.
+struct SpatialGrid {
+    double lat0 = 0, lon0 = 0, dlat = 1, dlon = 1;
+    int nx = 0, ny = 0;
+    std::vector<int> cell_first, cell_stop; // CSR over cells, row-major by latitude
+
+    void build(const robin_hood::unordered_map<int, Stop>& stops, double cell_m);
+
+    int cell_x(double lon) const { return std::clamp(static_cast<int>((lon - lon0) / dlon), 0, nx - 1); }
+    int cell_y(double lat) const { return std::clamp(static_cast<int>((lat - lat0) / dlat), 0, ny - 1); }
+
+    // Calls f(stop id) for every stop in a cell overlapping the circle; callers
+    // still check the exact distance.
+    template <class F>
+    void for_each_near(double lat, double lon, double radius_m, F f) const {
+        if (nx == 0) return;
+        double rl = radius_m / 111320.0;
+        double ro = rl / std::max(0.01, std::cos(lat * M_PI / 180.0));
+        for (int y = cell_y(lat - rl); y <= cell_y(lat + rl); ++y) {
+            for (int x = cell_x(lon - ro); x <= cell_x(lon + ro); ++x) {
+                int c = y * nx + x;
+                for (int i = cell_first[c]; i < cell_first[c + 1]; ++i) f(cell_stop[i]);
+            }
+        }
+    }
+};
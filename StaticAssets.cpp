@@ -0,0 +1,79 @@
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <cstdio>
+#include <cstdint>
+#include "StaticAssets.h"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+static const char* mime_type(const string& ext) {
+    if (ext == ".html" || ext == ".htm") return "text/html; charset=utf-8";
+    if (ext == ".js") return "text/javascript; charset=utf-8";
+    if (ext == ".css") return "text/css; charset=utf-8";
+    if (ext == ".json") return "application/json";
+    if (ext == ".svg") return "image/svg+xml";
+    if (ext == ".png") return "image/png";
+    if (ext == ".jpg" || ext == ".jpeg") return "image/jpeg";
+    if (ext == ".ico") return "image/x-icon";
+    if (ext == ".txt") return "text/plain; charset=utf-8";
+    return "application/octet-stream";
+}
+
+// 64-bit FNV-1a of the content, as 16 hex digits.
+static string content_hash(const string& s) {
+    uint64_t h = 1469598103934665603ull;
+    for (unsigned char c : s) {
+        h ^= c;
+        h *= 1099511628211ull;
+    }
+    char buf[20];
+    snprintf(buf, sizeof(buf), "%016llx", static_cast<unsigned long long>(h));
+    return buf;
+}
+
+size_t StaticAssets::load(const string& dir, int age) {
+    files.clear();
+    total = 0;
+    max_age = age;
+    error_code ec;
+    if (!fs::is_directory(dir, ec)) return 0;
+    for (auto it = fs::recursive_directory_iterator(dir, ec); !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+        if (!it->is_regular_file()) continue;
+        ifstream in(it->path(), ios::binary);
+        stringstream ss;
+        ss << in.rdbuf();
+        Asset a;
+        a.type = mime_type(it->path().extension().string());
+        a.etag = content_hash(ss.str());
+        a.body.build(ss.str());
+        total += a.body.identity.size() + a.body.gzip.size() + a.body.br.size();
+        files["/" + fs::relative(it->path(), dir).generic_string()] = move(a);
+    }
+    return files.size();
+}
+
+bool StaticAssets::serve(const httplib::Request& req, httplib::Response& res) const {
+    auto it = files.find(req.path.back() == '/' ? req.path + "index.html" : req.path);
+    if (it == files.end()) return false;
+    const Asset& a = it->second;
+
+    const char* encoding;
+    const string& body = a.body.pick(req.get_header_value("Accept-Encoding"), encoding);
+    string etag = "\"" + a.etag + (*encoding ? string("-") + encoding : string()) + "\"";
+    res.set_header("ETag", etag);
+    res.set_header("Vary", "Accept-Encoding");
+    res.set_header("Cache-Control", a.type.compare(0, 9, "text/html") == 0 ? string("no-cache")
+        : "public, max-age=" + to_string(max_age));
+
+    // If-None-Match lists ETags separated by commas, or is "*".
+    string match = req.get_header_value("If-None-Match");
+    if (match == "*" || (!match.empty() && match.find(etag) != string::npos)) {
+        res.status = 304;
+        return true;
+    }
+    if (*encoding) res.set_header("Content-Encoding", encoding);
+    res.set_content(body, a.type);
+    return true;
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <string>
+#include "Compress.h"
+#include "httplib.h"
+#include "robin_hood.h"
+
+// The web UI's files, read and compressed once at startup. Each encoding of a
+// file gets its own strong ETag, so a conditional request is answered 304
+// without touching the disk. HTML must be revalidated on every load; other
+// files may be reused for max_age seconds.
+class StaticAssets {
+public:
+    // Loads every regular file under dir; returns the number loaded.
+    size_t load(const std::string& dir, int max_age);
+    // Answers a GET or HEAD for a loaded file; false if there is none.
+    bool serve(const httplib::Request& req, httplib::Response& res) const;
+    size_t bytes() const { return total; }
+
+private:
+    struct Asset {
+        Precompressed body;
+        std::string type, etag; // etag without quotes or encoding suffix
+    };
+    robin_hood::unordered_map<std::string, Asset> files; // by URL path
+    int max_age = 0;
+    size_t total = 0;
+};
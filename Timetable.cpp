@@ -0,0 +1,255 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cctype>
+#include "Timetable.h"
+
+using namespace std;
+
+static void flatten(robin_hood::unordered_map<string, vector<StopTime>>& trips, Timetable& tt) {
+    tt.trip_ids.reserve(trips.size());
+    for (const auto& p : trips) tt.trip_ids.push_back(p.first);
+    sort(tt.trip_ids.begin(), tt.trip_ids.end());
+
+    tt.trip_first.assign(1, 0);
+    vector<int> per_stop(tt.n_ids + 1, 0);
+    for (int t = 0; t < tt.n_trips(); ++t) {
+        auto& sched = trips.at(tt.trip_ids[t]);
+        sort(sched.begin(), sched.end(),
+            [](const StopTime& a, const StopTime& b) { return a.seq < b.seq; });
+        for (const auto& st : sched) {
+            tt.ev_sid.push_back(st.sid);
+            tt.ev_arr.push_back(st.arr.to_secs());
+            tt.ev_dep.push_back(st.dep.to_secs());
+            tt.ev_trip.push_back(t);
+            ++per_stop[st.sid + 1];
+        }
+        tt.trip_first.push_back(static_cast<int>(tt.ev_sid.size()));
+    }
+
+    for (int s = 0; s < tt.n_ids; ++s) per_stop[s + 1] += per_stop[s];
+    tt.stop_first = per_stop;
+    tt.stop_ev.resize(tt.ev_sid.size());
+    for (int e = 0; e < static_cast<int>(tt.ev_sid.size()); ++e) {
+        tt.stop_ev[per_stop[tt.ev_sid[e]]++] = e;
+    }
+    for (int s = 0; s < tt.n_ids; ++s) {
+        stable_sort(tt.stop_ev.begin() + tt.stop_first[s], tt.stop_ev.begin() + tt.stop_first[s + 1],
+            [&](int a, int b) { return tt.ev_dep[a] < tt.ev_dep[b]; });
+    }
+}
+
+void stops_near(const Timetable& tt, double lat, double lon, double radius,
+    vector<pair<int, int>>& out) {
+    tt.grid.for_each_near(lat, lon, radius, [&](int sid) {
+        const Stop& s = tt.stops.at(sid);
+        double dist = haversine(lat, lon, s.lat, s.lon);
+        if (dist <= radius) out.push_back({ sid, static_cast<int>(dist / WALK_V) });
+        });
+}
+
+void next_departures(const Timetable& tt, int sid, int t, int n, vector<int>& out) {
+    auto lo = tt.stop_ev.begin() + tt.stop_first[sid], hi = tt.stop_ev.begin() + tt.stop_first[sid + 1];
+    for (auto it = lower_bound(lo, hi, t, [&](int e, int v) { return tt.ev_dep[e] < v; });
+        it != hi && static_cast<int>(out.size()) < n; ++it) {
+        if (*it + 1 < tt.trip_first[tt.ev_trip[*it] + 1]) out.push_back(*it);
+    }
+}
+
+void station_stops(const Timetable& tt, int sid, vector<int>& out) {
+    int st = tt.station_of[sid];
+    out.insert(out.end(), tt.station_stop.begin() + tt.station_first[st], tt.station_stop.begin() + tt.station_first[st + 1]);
+}
+
+static void build_walks(Timetable& tt) {
+    tt.grid.build(tt.stops, MAX_WALK);
+    tt.walk_first.assign(tt.n_ids + 1, 0);
+    tt.walk_to.clear();
+    tt.walk_dur.clear();
+    vector<pair<int, int>> near;
+    for (int sid = 0; sid < tt.n_ids; ++sid) {
+        auto it = tt.stops.find(sid);
+        if (it != tt.stops.end()) {
+            near.clear();
+            stops_near(tt, it->second.lat, it->second.lon, MAX_WALK, near);
+            for (const auto& p : near) {
+                if (p.first == sid) continue;
+                tt.walk_to.push_back(p.first);
+                tt.walk_dur.push_back(p.second);
+            }
+        }
+        tt.walk_first[sid + 1] = static_cast<int>(tt.walk_to.size());
+    }
+}
+
+// Names compared case-insensitively and without surrounding blanks, as the
+// feed spells one station's platforms inconsistently.
+static string station_key(const string& name) {
+    size_t b = name.find_first_not_of(" \t"), e = name.find_last_not_of(" \t");
+    string key = b == string::npos ? "" : name.substr(b, e - b + 1);
+    for (char& c : key) c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+    return key;
+}
+
+// A station is an unassigned stop plus every unassigned stop of the same name
+// within STATION_R of it. Platforms of one station get a transfer to each
+// other at walking time unless transfers.txt already has one, so changing
+// platforms is a transfer rather than an egress-and-access walk.
+static size_t build_stations(Timetable& tt) {
+    vector<string> key(tt.n_ids);
+    for (const auto& p : tt.stops) key[p.first] = station_key(p.second.name);
+    tt.station_of.assign(tt.n_ids, -1);
+    tt.station_first.assign(1, 0);
+    tt.station_stop.clear();
+    for (int sid = 0; sid < tt.n_ids; ++sid) {
+        auto it = tt.stops.find(sid);
+        if (it == tt.stops.end() || tt.station_of[sid] >= 0) continue;
+        const Stop& st = it->second;
+        int id = tt.n_stations();
+        tt.grid.for_each_near(st.lat, st.lon, STATION_R, [&](int o) {
+            const Stop& s = tt.stops.at(o);
+            if (tt.station_of[o] < 0 && key[o] == key[sid] && haversine(st.lat, st.lon, s.lat, s.lon) <= STATION_R) {
+                tt.station_of[o] = id;
+                tt.station_stop.push_back(o);
+            }
+            });
+        sort(tt.station_stop.begin() + tt.station_first[id], tt.station_stop.end());
+        tt.station_first.push_back(static_cast<int>(tt.station_stop.size()));
+    }
+
+    size_t added = 0;
+    for (int id = 0; id < tt.n_stations(); ++id) {
+        for (int i = tt.station_first[id]; i < tt.station_first[id + 1]; ++i) {
+            int a = tt.station_stop[i];
+            const Stop& sa = tt.stops.at(a);
+            auto& out = tt.transfers[a];
+            for (int j = tt.station_first[id]; j < tt.station_first[id + 1]; ++j) {
+                int b = tt.station_stop[j];
+                if (a == b || any_of(out.begin(), out.end(), [&](const Transfer& t) { return t.v == b; })) continue;
+                const Stop& sb = tt.stops.at(b);
+                out.push_back({ a, b, static_cast<int>(haversine(sa.lat, sa.lon, sb.lat, sb.lon) / WALK_V) });
+                ++added;
+            }
+            if (out.empty()) tt.transfers.erase(a);
+        }
+    }
+    return added;
+}
+
+// Fields of one line of the optional files, whose column layout varies
+// between feeds and is read from their header.
+static vector<string> fields(string line) {
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    vector<string> f;
+    stringstream ss(line);
+    string field;
+    while (getline(ss, field, ',')) f.push_back(field);
+    return f;
+}
+
+static int column(const vector<string>& header, const string& name) {
+    auto it = find(header.begin(), header.end(), name);
+    return it == header.end() ? -1 : static_cast<int>(it - header.begin());
+}
+
+// Route names and headsigns per trip. Without trips.txt they stay empty; a
+// missing headsign falls back to the name of the trip's last stop.
+static void load_trip_info(const string& dir, Timetable& tt) {
+    tt.trip_route.assign(tt.n_trips(), "");
+    tt.trip_headsign.assign(tt.n_trips(), "");
+    robin_hood::unordered_map<string, string> route_name;
+    string line;
+    ifstream routes_file(dir + "/routes.txt");
+    if (getline(routes_file, line)) {
+        auto h = fields(line);
+        int id = column(h, "route_id"), name = column(h, "route_short_name");
+        while (id >= 0 && name >= 0 && getline(routes_file, line)) {
+            auto f = fields(line);
+            if (static_cast<int>(f.size()) > max(id, name)) route_name[f[id]] = f[name];
+        }
+    }
+
+    robin_hood::unordered_map<string, int> trip_of;
+    for (int t = 0; t < tt.n_trips(); ++t) trip_of[tt.trip_ids[t]] = t;
+    ifstream trips_file(dir + "/trips.txt");
+    if (getline(trips_file, line)) {
+        auto h = fields(line);
+        int route = column(h, "route_id"), trip = column(h, "trip_id"), sign = column(h, "trip_headsign");
+        while (route >= 0 && trip >= 0 && getline(trips_file, line)) {
+            auto f = fields(line);
+            if (static_cast<int>(f.size()) <= max(route, trip)) continue;
+            auto t = trip_of.find(f[trip]);
+            if (t == trip_of.end()) continue;
+            auto r = route_name.find(f[route]);
+            tt.trip_route[t->second] = r != route_name.end() ? r->second : f[route];
+            if (sign >= 0 && sign < static_cast<int>(f.size())) tt.trip_headsign[t->second] = f[sign];
+        }
+    }
+    for (int t = 0; t < tt.n_trips(); ++t) {
+        auto s = tt.stops.find(tt.ev_sid[tt.trip_first[t + 1] - 1]);
+        if (tt.trip_headsign[t].empty() && s != tt.stops.end()) tt.trip_headsign[t] = s->second.name;
+    }
+}
+
+void load_data(const string& dir, Timetable& tt) {
+    ifstream stops_file(dir + "/stops.txt");
+    string line;
+    getline(stops_file, line);
+    while (getline(stops_file, line)) {
+        stringstream ss(line);
+        string field;
+        Stop s;
+        getline(ss, field, ','); s.id = stoi(field);
+        getline(ss, field, ',');
+        getline(ss, field, ','); s.name = field;
+        getline(ss, field, ','); s.lat = stod(field);
+        getline(ss, field, ','); s.lon = stod(field);
+        tt.stops[s.id] = s;
+        tt.name_to_id[s.name] = s.id;
+        tt.n_ids = max(tt.n_ids, s.id + 1);
+    }
+
+    robin_hood::unordered_map<string, vector<StopTime>> trips;
+    ifstream stop_times_file(dir + "/stop_times.txt");
+    getline(stop_times_file, line);
+    while (getline(stop_times_file, line)) {
+        stringstream ss(line);
+        string field;
+        StopTime st;
+        getline(ss, field, ','); st.tid = field;
+        getline(ss, field, ':'); st.arr.h = stoi(field);
+        getline(ss, field, ':'); st.arr.m = stoi(field);
+        getline(ss, field, ','); st.arr.s = stoi(field);
+        getline(ss, field, ':'); st.dep.h = stoi(field);
+        getline(ss, field, ':'); st.dep.m = stoi(field);
+        getline(ss, field, ','); st.dep.s = stoi(field);
+        getline(ss, field, ','); st.sid = stoi(field);
+        getline(ss, field, ','); st.seq = stoi(field);
+        trips[st.tid].push_back(st);
+        tt.n_ids = max(tt.n_ids, st.sid + 1);
+    }
+
+    ifstream transfers_file(dir + "/transfers.txt");
+    getline(transfers_file, line);
+    while (getline(transfers_file, line)) {
+        stringstream ss(line);
+        string field;
+        Transfer t;
+        getline(ss, field, ','); t.u = stoi(field);
+        getline(ss, field, ','); t.v = stoi(field);
+        getline(ss, field, ',');
+        getline(ss, field, ','); t.dur = stoi(field);
+        tt.transfers[t.u].push_back(t);
+        tt.n_ids = max(tt.n_ids, max(t.u, t.v) + 1);
+    }
+
+    flatten(trips, tt);
+    load_trip_info(dir, tt);
+    build_walks(tt);
+    size_t added = build_stations(tt);
+    cout << "GTFS data loaded: " << tt.stops.size() << " stops in " << tt.n_stations() << " stations, "
+        << added << " intra-station transfers added." << endl;
+}
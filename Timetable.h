@@ -0,0 +1,50 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <utility>
+#include "DataTypes.h"
+#include "SpatialGrid.h"
+#include "robin_hood.h"
+
+// Loaded feed. Trips are flattened into one event array ordered by trip and
+// stop sequence, so a trip is the contiguous range [trip_first[t], trip_first[t + 1]).
+struct Timetable {
+    robin_hood::unordered_map<int, Stop> stops;
+    robin_hood::unordered_map<int, std::vector<Transfer>> transfers;
+    robin_hood::unordered_map<std::string, int> name_to_id;
+    int n_ids = 0; // one past the largest stop id
+
+    std::vector<std::string> trip_ids;
+    std::vector<std::string> trip_route, trip_headsign; // from trips.txt and routes.txt, empty when absent
+    std::vector<int> trip_first;
+    std::vector<int> ev_sid, ev_arr, ev_dep, ev_trip;
+
+    // Events at each stop id by departure: stop_ev[stop_first[sid] .. stop_first[sid + 1]).
+    std::vector<int> stop_first, stop_ev;
+
+    // Street walks of up to MAX_WALK between stops, in seconds, by stop id:
+    // walk_to / walk_dur over [walk_first[sid], walk_first[sid + 1]).
+    SpatialGrid grid;
+    std::vector<int> walk_first, walk_to, walk_dur;
+
+    // Stops grouped into stations: station_stop[station_first[st] .. station_first[st + 1]),
+    // and station_of by stop id (-1 for ids without a stop).
+    std::vector<int> station_of, station_first, station_stop;
+
+    int n_trips() const { return static_cast<int>(trip_ids.size()); }
+    int n_stations() const { return static_cast<int>(station_first.size()) - 1; }
+};
+
+void load_data(const std::string& dir, Timetable& tt);
+
+// Stops within radius metres of a point, as (stop id, walking seconds).
+void stops_near(const Timetable& tt, double lat, double lon, double radius,
+    std::vector<std::pair<int, int>>& out);
+
+// Up to n events departing sid at or after t, earliest first, leaving out the
+// last stop of each trip.
+void next_departures(const Timetable& tt, int sid, int t, int n, std::vector<int>& out);
+
+// The stops of sid's station: the platforms a query by name may start or end
+// at interchangeably.
+void station_stops(const Timetable& tt, int sid, std::vector<int>& out);
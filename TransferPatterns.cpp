@@ -0,0 +1,398 @@
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+#include <omp.h>
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include "TransferPatterns.h"
+#include "robin_hood.h"
+
+using namespace std;
+
+constexpr uint32_t TP_MAGIC = 0x54415054; // "TPAT"
+constexpr uint32_t TP_VERSION = 1;
+constexpr size_t TP_HEADER = 16;
+
+static void put_varint(string& out, uint64_t v) {
+    while (v >= 0x80) {
+        out += static_cast<char>(v | 0x80);
+        v >>= 7;
+    }
+    out += static_cast<char>(v);
+}
+
+// False if the varint runs past end or over 64 bits.
+static bool get_varint(const unsigned char*& p, const unsigned char* end, uint64_t& v) {
+    v = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+        unsigned char b = *p++;
+        v |= uint64_t(b & 0x7f) << shift;
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+// Every time at which leaving src lets some boarding be just caught: a
+// departure from one of its access stops less the walk there. Between two of
+// these the same boardings are available, so searches at all of them see every
+// journey a query can get. The first sampled time adds the journeys on foot.
+static void departure_times(int src, int first, const Timetable& tt, vector<int>& deps) {
+    vector<Seed> seeds;
+    stop_access({ src }, tt, seeds);
+    deps.assign(1, first);
+    for (const auto& s : seeds) {
+        for (int i = tt.stop_first[s.sid]; i < tt.stop_first[s.sid + 1]; ++i) {
+            deps.push_back(max(first, tt.ev_dep[tt.stop_ev[i]] - s.secs));
+        }
+    }
+    sort(deps.begin(), deps.end());
+    deps.erase(unique(deps.begin(), deps.end()), deps.end());
+}
+
+// All patterns out of src over the sampled departures (every departure when
+// sampled is empty), encoded as one block.
+static void build_source(int src, const vector<int>& sampled, int first, const Timetable& tt, QueryContext& ctx,
+    string& block, PatternStats& stats) {
+    vector<uint32_t> stop = { static_cast<uint32_t>(src) }, parent = { ~0u };
+    robin_hood::unordered_map<uint64_t, uint32_t> child; // parent << 32 | stop code -> node
+    robin_hood::unordered_set<uint64_t> ends; // target << 32 | node
+    vector<uint32_t> path;
+    vector<int> every;
+    if (sampled.empty()) departure_times(src, first, tt, every);
+
+    for (int dep : sampled.empty() ? every : sampled) {
+        run_one_to_all(src, Time::from_secs(dep), tt, ctx);
+        for (int k = 0; k <= MAX_K; ++k) {
+            for (int sid : ctx.touched[k]) {
+                int arr = arr_of(ctx.dp[k][sid]);
+                bool pareto = true;
+                for (int e = 0; e < k && pareto; ++e) pareto = arr_of(ctx.dp[e][sid]) > arr;
+                if (!pareto) continue;
+
+                path.clear();
+                int s = sid, r = k;
+                for (Label l = ctx.label(s, r); l.from != -1; l = ctx.label(s, r)) {
+                    path.push_back(l.trip == -1 ? s | WALK : s);
+                    if (l.trip != -1) --r;
+                    s = l.from;
+                }
+                uint32_t node = 0;
+                for (auto it = path.rbegin(); it != path.rend(); ++it) {
+                    uint64_t key = (uint64_t(node) << 32) | *it;
+                    auto f = child.find(key);
+                    if (f == child.end()) {
+                        f = child.emplace(key, static_cast<uint32_t>(stop.size())).first;
+                        stop.push_back(*it);
+                        parent.push_back(node);
+                    }
+                    node = f->second;
+                }
+                if (node) ends.insert((uint64_t(sid) << 32) | node);
+            }
+        }
+    }
+
+    vector<uint64_t> sorted(ends.begin(), ends.end());
+    sort(sorted.begin(), sorted.end());
+    block.clear();
+    put_varint(block, stop.size());
+    put_varint(block, sorted.size());
+    for (size_t i = 1; i < stop.size(); ++i) {
+        put_varint(block, i - parent[i]);
+        put_varint(block, (uint64_t(stop[i] & ~WALK) << 1) | ((stop[i] & WALK) ? 1 : 0));
+    }
+    uint64_t prev = 0;
+    for (uint64_t e : sorted) {
+        put_varint(block, (e >> 32) - prev);
+        put_varint(block, e & 0xffffffffu);
+        prev = e >> 32;
+    }
+    stats.nodes += stop.size();
+    stats.ends += sorted.size();
+}
+
+bool build_patterns(const Timetable& tt, int step_min, const string& path, PatternStats& stats) {
+    auto t0 = chrono::steady_clock::now();
+    ofstream out(path, ios::binary);
+    if (!out) return false;
+
+    int first = INF_T, last = 0;
+    for (size_t e = 0; e < tt.ev_dep.size(); ++e) {
+        first = min(first, tt.ev_dep[e]);
+        last = max(last, tt.ev_dep[e]);
+    }
+    vector<int> deps;
+    for (int t = first; step_min > 0 && t <= last; t += step_min * 60) deps.push_back(t);
+
+    uint32_t header[4] = { TP_MAGIC, TP_VERSION, static_cast<uint32_t>(tt.n_ids), static_cast<uint32_t>(max(0, step_min)) };
+    vector<uint64_t> offset(tt.n_ids + 1, 0);
+    out.write(reinterpret_cast<const char*>(header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(offset.data()), offset.size() * sizeof(uint64_t));
+    uint64_t pos = TP_HEADER + offset.size() * sizeof(uint64_t);
+
+    // Blocks finish out of order; each is written once all lower ids are.
+    vector<string> blocks(tt.n_ids);
+    vector<char> done(tt.n_ids, 0);
+    int next = 0, finished = 0;
+
+#pragma omp parallel
+    {
+        QueryContext ctx;
+        ctx.reserve(tt);
+        PatternStats local;
+#pragma omp for schedule(dynamic, 1)
+        for (int sid = 0; sid < tt.n_ids; ++sid) {
+            string block;
+            if (tt.stops.count(sid)) build_source(sid, deps, first, tt, ctx, block, local);
+#pragma omp critical(tp_write)
+            {
+                blocks[sid] = move(block);
+                done[sid] = 1;
+                for (; next < tt.n_ids && done[next]; ++next) {
+                    offset[next] = pos;
+                    out.write(blocks[next].data(), blocks[next].size());
+                    pos += blocks[next].size();
+                    string().swap(blocks[next]);
+                }
+                if (++finished % 500 == 0) cout << "  " << finished << " / " << tt.n_ids << " sources" << endl;
+            }
+        }
+#pragma omp critical(tp_write)
+        {
+            stats.nodes += local.nodes;
+            stats.ends += local.ends;
+        }
+    }
+    offset[tt.n_ids] = pos;
+    out.seekp(TP_HEADER);
+    out.write(reinterpret_cast<const char*>(offset.data()), offset.size() * sizeof(uint64_t));
+    out.close();
+
+    stats.bytes = pos;
+    stats.secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+    return static_cast<bool>(out);
+}
+
+TransferPatterns::~TransferPatterns() {
+    close();
+}
+
+void TransferPatterns::close() {
+    if (!data) return;
+#ifdef _WIN32
+    UnmapViewOfFile(data);
+    CloseHandle(mapping);
+    CloseHandle(file);
+#else
+    munmap(const_cast<unsigned char*>(data), size);
+#endif
+    data = nullptr;
+}
+
+bool TransferPatterns::open(const string& path, const Timetable& tt) {
+#ifdef _WIN32
+    HANDLE f = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, 0, nullptr);
+    if (f == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER len;
+    GetFileSizeEx(f, &len);
+    HANDLE m = CreateFileMappingA(f, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    void* p = m ? MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (!p) {
+        if (m) CloseHandle(m);
+        CloseHandle(f);
+        return false;
+    }
+    file = f;
+    mapping = m;
+    size = static_cast<size_t>(len.QuadPart);
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    fstat(fd, &st);
+    size = static_cast<size_t>(st.st_size);
+    void* p = size ? mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    ::close(fd);
+    if (p == MAP_FAILED) return false;
+#endif
+    data = static_cast<const unsigned char*>(p);
+
+    uint32_t header[4] = {};
+    if (size >= TP_HEADER) memcpy(header, data, sizeof(header));
+    n_ids = static_cast<int>(header[2]);
+    if (header[0] != TP_MAGIC || header[1] != TP_VERSION) {
+        cerr << path << " is not a transfer pattern file" << endl;
+        close();
+        return false;
+    }
+    if (n_ids != tt.n_ids) {
+        cerr << path << " was built for another timetable (" << n_ids << " stop ids, not " << tt.n_ids << ")" << endl;
+        close();
+        return false;
+    }
+    // Blocks must lie after the offset table, in order, within the file.
+    size_t table = TP_HEADER + (static_cast<size_t>(n_ids) + 1) * sizeof(uint64_t);
+    offset = size >= table ? reinterpret_cast<const uint64_t*>(data + TP_HEADER) : nullptr;
+    bool ordered = offset && offset[0] >= table && offset[n_ids] <= size;
+    for (int sid = 0; ordered && sid < n_ids; ++sid) ordered = offset[sid] <= offset[sid + 1];
+    if (!ordered) {
+        cerr << path << " is truncated or corrupt" << endl;
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool TransferPatterns::decode(int sid, Tree& out) const {
+    const unsigned char *p = data + offset[sid], *end = data + offset[sid + 1];
+    uint64_t n_nodes = 0, n_ends = 0;
+    // Every node after the root and every end takes at least two bytes.
+    if (!get_varint(p, end, n_nodes) || !get_varint(p, end, n_ends) || n_nodes == 0 ||
+        n_nodes - 1 > static_cast<uint64_t>(end - p) / 2 || n_ends > static_cast<uint64_t>(end - p) / 2) return false;
+    out.stop.resize(n_nodes);
+    out.parent.resize(n_nodes);
+    out.ends.resize(n_ends);
+    out.stop[0] = static_cast<uint32_t>(sid);
+    out.parent[0] = ~0u;
+    for (size_t i = 1; i < n_nodes; ++i) {
+        uint64_t up = 0, code = 0;
+        if (!get_varint(p, end, up) || !get_varint(p, end, code) || up == 0 || up > i ||
+            (code >> 1) >= static_cast<uint64_t>(n_ids)) return false;
+        out.parent[i] = static_cast<uint32_t>(i - up);
+        out.stop[i] = static_cast<uint32_t>(code >> 1) | ((code & 1) ? WALK : 0);
+    }
+    uint64_t target = 0;
+    for (size_t i = 0; i < n_ends; ++i) {
+        uint64_t delta = 0, node = 0;
+        if (!get_varint(p, end, delta) || !get_varint(p, end, node) || node >= n_nodes) return false;
+        target += delta;
+        if (target >= static_cast<uint64_t>(n_ids)) return false;
+        out.ends[i] = { static_cast<uint32_t>(target), static_cast<uint32_t>(node) };
+    }
+    return true;
+}
+
+// Earliest arrival at b on one trip boarded at a no earlier than t.
+static int ride(const Timetable& tt, int a, int b, int t, int& board) {
+    auto lo = tt.stop_ev.begin() + tt.stop_first[a], hi = tt.stop_ev.begin() + tt.stop_first[a + 1];
+    auto it = lower_bound(lo, hi, t, [&](int e, int v) { return tt.ev_dep[e] < v; });
+    int best = INF_T;
+    for (; it != hi && tt.ev_dep[*it] < best; ++it) {
+        int e = *it;
+        for (int f = e + 1; f < tt.trip_first[tt.ev_trip[e] + 1]; ++f) {
+            if (tt.ev_sid[f] != b) continue;
+            if (tt.ev_arr[f] < best) {
+                best = tt.ev_arr[f];
+                board = e;
+            }
+            break;
+        }
+    }
+    return best;
+}
+
+// Walk from a to b: a transfer, or from the root also a street footpath.
+static int walk_secs(const Timetable& tt, int a, int b, bool footpaths) {
+    int best = INF_T;
+    auto tr = tt.transfers.find(a);
+    if (tr != tt.transfers.end()) {
+        for (const auto& t : tr->second) {
+            if (t.v == b) best = min(best, t.dur);
+        }
+    }
+    if (footpaths) {
+        for (int i = tt.walk_first[a]; i < tt.walk_first[a + 1]; ++i) {
+            if (tt.walk_to[i] == b) best = min(best, tt.walk_dur[i]);
+        }
+    }
+    return best;
+}
+
+bool run_patterns(const vector<Seed>& seeds, const vector<Target>& targets, const Time& start_t,
+    const Timetable& tt, const TransferPatterns& tp, QueryContext& ctx) {
+    for (const auto& s : seeds) {
+        if (s.from == -1 && !tp.has(s.sid)) return false;
+    }
+    init_seeds(seeds, targets, start_t, ctx);
+
+    // One tree per origin seed, keeping only nodes on a pattern to some target.
+    // Nodes are settled round by round as in RAPTOR, so the destination bound
+    // never drops a label in favour of one with more trips; parents precede
+    // children, so node order within a round is enough.
+    auto& trees = ctx.patterns.trees;
+    auto& arr = ctx.patterns.arr;
+    auto& level = ctx.patterns.level;
+    auto& need = ctx.patterns.need;
+    auto& rounds = ctx.patterns.rounds;
+    for (auto& l : level) l.clear();
+    int n_trees = 0;
+    bool matched = false;
+    for (const auto& s : seeds) {
+        if (s.from != -1) continue;
+        if (static_cast<int>(trees.size()) == n_trees) {
+            trees.emplace_back();
+            arr.emplace_back();
+        }
+        auto& tree = trees[n_trees];
+        if (!tp.decode(s.sid, tree)) return false;
+        size_t n = tree.stop.size();
+
+        need.assign(n, 0);
+        for (const auto& t : targets) {
+            auto r = equal_range(tree.ends.begin(), tree.ends.end(), make_pair(uint32_t(t.sid), 0u),
+                [](const pair<uint32_t, uint32_t>& a, const pair<uint32_t, uint32_t>& b) { return a.first < b.first; });
+            for (auto it = r.first; it != r.second; ++it) {
+                matched = true;
+                for (uint32_t v = it->second; v && !need[v]; v = tree.parent[v]) need[v] = 1;
+            }
+        }
+        rounds.assign(n, 0);
+        for (size_t i = 1; i < n; ++i) {
+            rounds[i] = rounds[tree.parent[i]] + ((tree.stop[i] & WALK) ? 0 : 1);
+            if (need[i] && rounds[i] <= MAX_K) level[rounds[i]].push_back({ n_trees, static_cast<uint32_t>(i) });
+        }
+        arr[n_trees].assign(n, INF_T);
+        arr[n_trees][0] = arr_of(ctx.dp[0][s.sid]);
+        ++n_trees;
+    }
+    if (!matched) return false;
+
+    for (int k = 0; k <= MAX_K; ++k) {
+        for (const auto& e : level[k]) {
+            const auto& tree = trees[e.first];
+            auto& at = arr[e.first];
+            uint32_t i = e.second, p = tree.parent[i];
+            if (at[p] == INF_T) continue;
+            int a = static_cast<int>(tree.stop[p] & ~WALK), v = static_cast<int>(tree.stop[i] & ~WALK);
+            Packed l;
+            if (tree.stop[i] & WALK) {
+                int w = walk_secs(tt, a, v, p == 0);
+                if (w == INF_T) continue;
+                l = pack(at[p] + w, WALK | static_cast<uint32_t>(a));
+            }
+            else {
+                int board = 0, t = ride(tt, a, v, at[p], board);
+                if (t == INF_T) continue;
+                l = pack(t, static_cast<uint32_t>(board));
+            }
+            settle(ctx, k, v, l);
+            at[i] = arr_of(ctx.dp[k][v]);
+        }
+    }
+    collect_profile(targets, tt, ctx);
+    return !ctx.profile.empty();
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+#include "Timetable.h"
+#include "Raptor.h"
+
+// Precomputed transfer patterns: for every source stop, the stop sequences
+// (boardings, alightings and walks) of all optimal journeys seen by one-to-all
+// searches across the service day. Patterns out of one source share their
+// prefixes, so each source is a tree of (stop, parent) nodes plus, per target,
+// the nodes its patterns end at.
+//
+// File: "TPAT", version, n_ids, step (uint32 each); uint64 byte offset of every
+// source block [n_ids + 1]; then the blocks. A block is LEB128 varints:
+// n_nodes, n_ends; per node after the root, (index - parent) and
+// (stop << 1 | walked); per end sorted by target, (target delta, node).
+// The loader maps the file and decodes one block per query root.
+class TransferPatterns {
+public:
+    using Tree = PatternTree;
+
+    TransferPatterns() = default;
+    TransferPatterns(const TransferPatterns&) = delete;
+    TransferPatterns& operator=(const TransferPatterns&) = delete;
+    ~TransferPatterns();
+
+    // Fails on a file built for another timetable or whose offsets point
+    // outside it.
+    bool open(const std::string& path, const Timetable& tt);
+    bool loaded() const { return data != nullptr; }
+    bool has(int sid) const { return sid >= 0 && sid < n_ids && offset[sid] != offset[sid + 1]; }
+    // False, with out unusable, if the block is malformed.
+    bool decode(int sid, Tree& out) const;
+    std::size_t bytes() const { return size; }
+
+private:
+    void close();
+
+    const unsigned char* data = nullptr;
+    std::size_t size = 0;
+    const std::uint64_t* offset = nullptr;
+    int n_ids = 0;
+#ifdef _WIN32
+    void* file = nullptr;
+    void* mapping = nullptr;
+#endif
+};
+
+struct PatternStats {
+    double secs = 0;
+    std::size_t bytes = 0, nodes = 0, ends = 0;
+};
+
+// Runs a one-to-all search from every stop every step_min minutes over the
+// service day, in parallel over the sources, and writes the patterns to path.
+// With step_min 0 each stop is searched at every departure it can catch, which
+// makes run_patterns exact at any query time, at many times the build cost.
+bool build_patterns(const Timetable& tt, int step_min, const std::string& path, PatternStats& stats);
+
+// Point-to-point search over only the legs in the patterns of the seeds that
+// start at the origin (from == -1), with the same labels and profile as
+// run_raptor. Returns false, and the caller should search in full, if a seed
+// stop has no patterns (or a malformed block), none of them reaches a target, or they give no journey
+// at this time. Journeys are exact at the sampled departure times (any time
+// with step 0); between samples a faster journey may be missing.
+bool run_patterns(const std::vector<Seed>& seeds, const std::vector<Target>& targets, const Time& start_t,
+    const Timetable& tt, const TransferPatterns& tp, QueryContext& ctx);
@@ -0,0 +1,266 @@
+#include <vector>
+#include <array>
+#include <numeric>
+#include <algorithm>
+#include <chrono>
+#include <omp.h>
+#include "TripBased.h"
+
+using namespace std;
+
+static int trip_len(const Timetable& tt, int t) { return tt.trip_first[t + 1] - tt.trip_first[t]; }
+
+// b never passes a: it departs and arrives no earlier at every stop.
+static bool follows(const Timetable& tt, int a, int b) {
+    for (int i = 0; i < trip_len(tt, a); ++i) {
+        int ea = tt.trip_first[a] + i, eb = tt.trip_first[b] + i;
+        if (tt.ev_dep[eb] < tt.ev_dep[ea] || tt.ev_arr[eb] < tt.ev_arr[ea]) return false;
+    }
+    return true;
+}
+
+static void build_lines(const Timetable& tt, TripTransfers& tb) {
+    int n = tt.n_trips();
+    auto stops_of = [&](int t) { return make_pair(tt.ev_sid.begin() + tt.trip_first[t], tt.ev_sid.begin() + tt.trip_first[t + 1]); };
+    vector<int> order(n);
+    iota(order.begin(), order.end(), 0);
+    sort(order.begin(), order.end(), [&](int a, int b) {
+        auto sa = stops_of(a), sb = stops_of(b);
+        if (!equal(sa.first, sa.second, sb.first, sb.second)) {
+            return lexicographical_compare(sa.first, sa.second, sb.first, sb.second);
+        }
+        return tt.ev_dep[tt.trip_first[a]] < tt.ev_dep[tt.trip_first[b]];
+        });
+
+    // Trips with one stop sequence, by first departure, go to the first line
+    // they don't overtake.
+    vector<vector<int>> lines;
+    for (int g = 0; g < n;) {
+        int h = g;
+        auto sg = stops_of(order[g]);
+        while (h < n && equal(sg.first, sg.second, stops_of(order[h]).first, stops_of(order[h]).second)) ++h;
+        size_t first_line = lines.size();
+        for (int i = g; i < h; ++i) {
+            size_t l = first_line;
+            while (l < lines.size() && !follows(tt, lines[l].back(), order[i])) ++l;
+            if (l == lines.size()) lines.emplace_back();
+            lines[l].push_back(order[i]);
+        }
+        g = h;
+    }
+
+    tb.line_first.assign(1, 0);
+    tb.line_trip.clear();
+    tb.trip_line.assign(n, 0);
+    tb.trip_pos.assign(n, 0);
+    vector<int> per_stop(tt.n_ids + 1, 0);
+    for (size_t l = 0; l < lines.size(); ++l) {
+        for (size_t i = 0; i < lines[l].size(); ++i) {
+            tb.trip_line[lines[l][i]] = static_cast<int>(l);
+            tb.trip_pos[lines[l][i]] = static_cast<int>(i);
+            tb.line_trip.push_back(lines[l][i]);
+        }
+        tb.line_first.push_back(static_cast<int>(tb.line_trip.size()));
+        int t = lines[l][0];
+        for (int j = 0; j + 1 < trip_len(tt, t); ++j) ++per_stop[tt.ev_sid[tt.trip_first[t] + j] + 1];
+    }
+    for (int s = 0; s < tt.n_ids; ++s) per_stop[s + 1] += per_stop[s];
+    tb.stop_first = per_stop;
+    tb.stop_line.resize(per_stop[tt.n_ids]);
+    for (int l = 0; l < tb.n_lines(); ++l) {
+        int t = tb.line_trip[tb.line_first[l]];
+        for (int j = 0; j + 1 < trip_len(tt, t); ++j) {
+            tb.stop_line[per_stop[tt.ev_sid[tt.trip_first[t] + j]]++] = { l, j };
+        }
+    }
+}
+
+// Earliest trip of line l leaving its j-th stop at or after t, or -1.
+static int earliest(const Timetable& tt, const TripTransfers& tb, int l, int j, int t) {
+    auto lo = tb.line_trip.begin() + tb.line_first[l], hi = tb.line_trip.begin() + tb.line_first[l + 1];
+    auto it = lower_bound(lo, hi, t, [&](int u, int v) { return tt.ev_dep[tt.trip_first[u] + j] < v; });
+    return it == hi ? -1 : *it;
+}
+
+struct Reducer {
+    vector<int> best, dirty;
+
+    bool improve(int sid, int t) {
+        if (t >= best[sid]) return false;
+        if (best[sid] == INF_T) dirty.push_back(sid);
+        best[sid] = t;
+        return true;
+    }
+    // Arrival at sid at time t, plus the transfer walks out of it.
+    bool reach(const TripTransfers& tb, int sid, int t) {
+        bool better = improve(sid, t);
+        for (int x = tb.xfer_first[sid]; x < tb.xfer_first[sid + 1]; ++x) {
+            if (improve(tb.xfer_to[x], t + tb.xfer_dur[x])) better = true;
+        }
+        return better;
+    }
+    void clear() {
+        for (int s : dirty) best[s] = INF_T;
+        dirty.clear();
+    }
+};
+
+// Transfers out of trip t as (arrival event, boarding event, walk). Walking
+// the trip backwards, a candidate is kept only if riding it reaches some stop
+// earlier than staying on t or any transfer already kept further along.
+static size_t trip_transfers(int t, const Timetable& tt, const TripTransfers& tb, Reducer& r,
+    vector<array<int, 3>>& out) {
+    size_t candidates = 0;
+    for (int i = trip_len(tt, t) - 1; i >= 1; --i) {
+        int e = tt.trip_first[t] + i, p = tt.ev_sid[e], a = tt.ev_arr[e];
+        r.reach(tb, p, a);
+        for (int x = tb.xfer_first[p] - 1; x < tb.xfer_first[p + 1]; ++x) {
+            int q = x < tb.xfer_first[p] ? p : tb.xfer_to[x];
+            int d = x < tb.xfer_first[p] ? 0 : tb.xfer_dur[x];
+            for (int y = tb.stop_first[q]; y < tb.stop_first[q + 1]; ++y) {
+                int l = tb.stop_line[y].first, j = tb.stop_line[y].second;
+                int u = earliest(tt, tb, l, j, a + d);
+                if (u < 0) continue;
+                if (l == tb.trip_line[t] && tb.trip_pos[u] >= tb.trip_pos[t] && j >= i) continue;
+                ++candidates;
+                bool keep = false;
+                for (int f = tt.trip_first[u] + j + 1; f < tt.trip_first[u + 1]; ++f) {
+                    if (r.reach(tb, tt.ev_sid[f], tt.ev_arr[f])) keep = true;
+                }
+                if (keep) out.push_back({ e, tt.trip_first[u] + j, d });
+            }
+        }
+    }
+    r.clear();
+    return candidates;
+}
+
+void build_trip_transfers(const Timetable& tt, TripTransfers& tb) {
+    auto t0 = chrono::steady_clock::now();
+    tb.xfer_first.assign(tt.n_ids + 1, 0);
+    tb.xfer_to.clear();
+    tb.xfer_dur.clear();
+    for (int s = 0; s < tt.n_ids; ++s) {
+        auto it = tt.transfers.find(s);
+        if (it != tt.transfers.end()) {
+            for (const auto& x : it->second) {
+                tb.xfer_to.push_back(x.v);
+                tb.xfer_dur.push_back(x.dur);
+            }
+        }
+        tb.xfer_first[s + 1] = static_cast<int>(tb.xfer_to.size());
+    }
+    tb.xfer_in_first.assign(tt.n_ids + 1, 0);
+    for (int v : tb.xfer_to) ++tb.xfer_in_first[v + 1];
+    for (int s = 0; s < tt.n_ids; ++s) tb.xfer_in_first[s + 1] += tb.xfer_in_first[s];
+    tb.xfer_in_from.resize(tb.xfer_to.size());
+    vector<int> fill(tb.xfer_in_first.begin(), tb.xfer_in_first.end() - 1);
+    for (int s = 0; s < tt.n_ids; ++s) {
+        for (int x = tb.xfer_first[s]; x < tb.xfer_first[s + 1]; ++x) tb.xfer_in_from[fill[tb.xfer_to[x]]++] = s;
+    }
+    build_lines(tt, tb);
+
+    int n = tt.n_trips();
+    vector<vector<array<int, 3>>> per_trip(n);
+    size_t candidates = 0;
+#pragma omp parallel reduction(+ : candidates)
+    {
+        Reducer r;
+        r.best.assign(tt.n_ids, INF_T);
+#pragma omp for schedule(dynamic, 64)
+        for (int t = 0; t < n; ++t) candidates += trip_transfers(t, tt, tb, r, per_trip[t]);
+    }
+
+    tb.tr_first.assign(tt.ev_sid.size() + 1, 0);
+    tb.tr_to.clear();
+    tb.tr_dur.clear();
+    for (int t = 0; t < n; ++t) {
+        sort(per_trip[t].begin(), per_trip[t].end());
+        for (const auto& x : per_trip[t]) {
+            ++tb.tr_first[x[0] + 1];
+            tb.tr_to.push_back(x[1]);
+            tb.tr_dur.push_back(x[2]);
+        }
+    }
+    for (size_t e = 0; e < tt.ev_sid.size(); ++e) tb.tr_first[e + 1] += tb.tr_first[e];
+    tb.candidates = candidates;
+    tb.secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+}
+
+// Queues trip segment b.. for the next scan: from boarding event b up to where
+// the trip was already reached. Later trips of the line are marked too, as
+// boarding them here can only be worse.
+static void enqueue(int b, const Timetable& tt, const TripTransfers& tb, vector<int>& reached,
+    vector<int>& reached_list, vector<pair<int, int>>& q) {
+    int u = tt.ev_trip[b], j = b - tt.trip_first[u];
+    int r = reached[u];
+    if (r <= j) return;
+    q.push_back({ b, r == INF_T ? tt.trip_first[u + 1] - 1 : tt.trip_first[u] + r });
+    int l = tb.trip_line[u];
+    for (int x = tb.line_first[l] + tb.trip_pos[u]; x < tb.line_first[l + 1]; ++x) {
+        int& rx = reached[tb.line_trip[x]];
+        if (rx <= j) break;
+        if (rx == INF_T) reached_list.push_back(tb.line_trip[x]);
+        rx = j;
+    }
+}
+
+void run_trip_based(const vector<Seed>& seeds, const vector<Target>& targets, const Time& start_t,
+    const Timetable& tt, const TripTransfers& tb, QueryContext& ctx) {
+    init_seeds(seeds, targets, start_t, ctx);
+
+    auto& reached = ctx.trip_based.reached;
+    auto& reached_list = ctx.trip_based.reached_list;
+    auto& cur = ctx.trip_based.cur;
+    auto& next = ctx.trip_based.next;
+    auto& walk_in = ctx.trip_based.walk_in;
+    if (static_cast<int>(reached.size()) < tt.n_trips()) reached.assign(tt.n_trips(), INF_T);
+    if (static_cast<int>(walk_in.size()) < tt.n_ids) walk_in.assign(tt.n_ids, 0);
+    for (int v : ctx.target_sids) {
+        for (int x = tb.xfer_in_first[v]; x < tb.xfer_in_first[v + 1]; ++x) walk_in[tb.xfer_in_from[x]] = 1;
+    }
+
+    cur.clear();
+    for (int sid : ctx.touched[0]) {
+        int a = arr_of(ctx.dp[0][sid]);
+        for (int y = tb.stop_first[sid]; y < tb.stop_first[sid + 1]; ++y) {
+            int u = earliest(tt, tb, tb.stop_line[y].first, tb.stop_line[y].second, a);
+            if (u >= 0) enqueue(tt.trip_first[u] + tb.stop_line[y].second, tt, tb, reached, reached_list, cur);
+        }
+    }
+
+    for (int k = 1; k <= MAX_K && !cur.empty() && !ctx.out_of_time(); ++k) {
+        ++ctx.rounds;
+        next.clear();
+        for (const auto& seg : cur) {
+            // A round on a big feed can outlast the budget, so the deadline
+            // is also checked every 256 segments.
+            if ((++ctx.scanned & 255) == 0 && ctx.out_of_time()) break;
+            for (int f = seg.first + 1; f <= seg.second; ++f) {
+                int a = tt.ev_arr[f], p = tt.ev_sid[f];
+                if (a >= ctx.bound) break;
+                settle(ctx, k, p, pack(a, static_cast<uint32_t>(seg.first)));
+                if (walk_in[p]) {
+                    for (int x = tb.xfer_first[p]; x < tb.xfer_first[p + 1]; ++x) {
+                        if (ctx.egress[tb.xfer_to[x]] == INF_T) continue;
+                        settle(ctx, k, tb.xfer_to[x], pack(a + tb.xfer_dur[x], WALK | static_cast<uint32_t>(p)));
+                    }
+                }
+                if (k == MAX_K) continue;
+                for (int x = tb.tr_first[f]; x < tb.tr_first[f + 1]; ++x) {
+                    int g = tb.tr_to[x], q = tt.ev_sid[g];
+                    if (q != p) settle(ctx, k, q, pack(a + tb.tr_dur[x], WALK | static_cast<uint32_t>(p)));
+                    if (arr_of(ctx.dp[k][q]) <= tt.ev_dep[g]) enqueue(g, tt, tb, reached, reached_list, next);
+                }
+            }
+        }
+        swap(cur, next);
+    }
+
+    for (int u : reached_list) reached[u] = INF_T;
+    reached_list.clear();
+    for (int v : ctx.target_sids) {
+        for (int x = tb.xfer_in_first[v]; x < tb.xfer_in_first[v + 1]; ++x) walk_in[tb.xfer_in_from[x]] = 0;
+    }
+    collect_profile(targets, tt, ctx);
+}
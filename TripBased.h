@@ -0,0 +1,31 @@
+#pragma once
+#include <vector>
+#include <utility>
+#include "Timetable.h"
+#include "Raptor.h"
+
+// Trip-Based routing data. Trips with the same stop sequence that never
+// overtake each other form a line, so "the earliest trip of a line at a stop"
+// is a binary search. Trip transfers go from an arrival event to the boarding
+// event of the earliest reachable trip of each line at the same stop or one
+// transfer walk away, reduced to those that improve some arrival.
+struct TripTransfers {
+    std::vector<int> line_first, line_trip; // trips of each line in departure order
+    std::vector<int> trip_line, trip_pos;
+    std::vector<int> stop_first; // (line, position) pairs at each stop: stop_line[stop_first[sid] ..)
+    std::vector<std::pair<int, int>> stop_line;
+    std::vector<int> tr_first, tr_to, tr_dur; // by arrival event: target boarding event, walk seconds
+    std::vector<int> xfer_first, xfer_to, xfer_dur; // tt.transfers as CSR by stop
+    std::vector<int> xfer_in_first, xfer_in_from; // the same walks by the stop they lead to
+    std::size_t candidates = 0; // before reduction
+    double secs = 0;
+
+    int n_lines() const { return static_cast<int>(line_first.size()) - 1; }
+};
+
+void build_trip_transfers(const Timetable& tt, TripTransfers& tb);
+
+// Same search as run_raptor over trip transfers instead of route scans. It
+// fills the same round labels, so ctx.pred and ctx.profile read as usual.
+void run_trip_based(const std::vector<Seed>& seeds, const std::vector<Target>& targets, const Time& start_t,
+    const Timetable& tt, const TripTransfers& tb, QueryContext& ctx);
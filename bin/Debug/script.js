@@ -57,13 +57,24 @@ document.addEventListener('DOMContentLoaded', () => {
     }
 
     // --- Autocomplete Logic ---
-    function showSuggestions(inputValue, suggestionsContainer, inputElement) {
+    // Suggestions come from the server; a reply to an older keystroke is dropped.
+    const latestQuery = new Map();
+    async function showSuggestions(inputValue, suggestionsContainer, inputElement) {
+        latestQuery.set(inputElement, inputValue);
+        if (!inputValue) {
+            suggestionsContainer.innerHTML = '';
+            return;
+        }
+        let matches = [];
+        try {
+            const response = await fetch(`/api/autocomplete?q=${encodeURIComponent(inputValue)}&n=10`);
+            matches = await response.json();
+        } catch (error) {
+            return;
+        }
+        if (latestQuery.get(inputElement) !== inputValue) return;
         suggestionsContainer.innerHTML = '';
-        if (!inputValue) return;
-        const filteredStops = allStops.filter(stop =>
-        stop.name.toLowerCase().includes(inputValue.toLowerCase())
-        ).slice(0, 10);
-        filteredStops.forEach(stop => {
+        matches.forEach(stop => {
             const div = document.createElement('div');
             div.textContent = stop.name;
             div.className = 'suggestion-item';
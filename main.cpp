@@ -1,164 +1,1015 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <chrono>
 #include <vector>
+#include <deque>
 #include <string>
 #include <algorithm>
+#include <thread>
+#include <future>
+#include <memory>
+#include <cstdlib>
+#include <functional>
 #include "httplib.h"
 #include "DataTypes.h"
+#include "Timetable.h"
 #include "Raptor.h"
+#include "QueryPool.h"
+#include "ScanKernel.h"
+#include "Isochrone.h"
+#include "TransferPatterns.h"
+#include "TripBased.h"
+#include "Csa.h"
+#include "Partition.h"
+#include "ResultCache.h"
+#include "JsonWriter.h"
+#include "BinaryWriter.h"
+#include "Compress.h"
+#include "Autocomplete.h"
+#include "StaticAssets.h"
+#include "Metrics.h"
 #include "robin_hood.h"
 
 using namespace std;
 
-void load_data(const string& dir,
-    robin_hood::unordered_map<int, Stop>& stops,
-    robin_hood::unordered_map<string, vector<StopTime>>& trips,
-    robin_hood::unordered_map<int, vector<Transfer>>& transfers,
-    robin_hood::unordered_map<int, vector<string>>& routes_at_stop,
-    robin_hood::unordered_map<string, int>& name_to_id) {
+// Comma-separated stop ids, all of which must exist in the feed.
+bool parse_ids(const string& csv, const Timetable& tt, vector<int>& out) {
+    stringstream ss(csv);
+    string field;
+    while (getline(ss, field, ',')) {
+        char* end = nullptr;
+        long id = strtol(field.c_str(), &end, 10);
+        if (field.empty() || *end != '\0' || !tt.stops.count(static_cast<int>(id))) return false;
+        out.push_back(static_cast<int>(id));
+    }
+    return !out.empty();
+}
 
-    ifstream stops_file(dir + "/stops.txt");
-    string line;
-    getline(stops_file, line);
-    while (getline(stops_file, line)) {
-        stringstream ss(line);
-        string field;
-        Stop s;
-        getline(ss, field, ','); s.id = stoi(field);
-        getline(ss, field, ',');
-        getline(ss, field, ','); s.name = field;
-        getline(ss, field, ','); s.lat = stod(field);
-        getline(ss, field, ','); s.lon = stod(field);
-        stops[s.id] = s;
-        name_to_id[s.name] = s.id;
-    }
-
-    ifstream stop_times_file(dir + "/stop_times.txt");
-    getline(stop_times_file, line);
-    while (getline(stop_times_file, line)) {
-        stringstream ss(line);
-        string field;
-        StopTime st;
-        getline(ss, field, ','); st.tid = field;
-        getline(ss, field, ':'); st.arr.h = stoi(field);
-        getline(ss, field, ':'); st.arr.m = stoi(field);
-        getline(ss, field, ','); st.arr.s = stoi(field);
-        getline(ss, field, ':'); st.dep.h = stoi(field);
-        getline(ss, field, ':'); st.dep.m = stoi(field);
-        getline(ss, field, ','); st.dep.s = stoi(field);
-        getline(ss, field, ','); st.sid = stoi(field);
-        getline(ss, field, ','); st.seq = stoi(field);
-        trips[st.tid].push_back(st);
+// "HH:MM" departure time; hours run past 24 as GTFS times do.
+bool parse_time(const string& s, Time& t) {
+    return sscanf(s.c_str(), "%d:%d", &t.h, &t.m) == 2 && t.h >= 0 && t.h < 48 && t.m >= 0 && t.m < 60;
+}
+
+// One end of a /calculate query: a stop, or an arbitrary point off the network.
+struct Endpoint {
+    int sid = -1;
+    double lat = 0, lon = 0;
+};
+
+constexpr int ORIGIN_PT = -2, DEST_PT = -3; // path entries for point endpoints
+
+thread_local chrono::steady_clock::time_point request_start; // set before routing, read by the logger
+
+// "<key>" names a stop; otherwise "<key>_lat" and "<key>_lon" give a point.
+bool parse_endpoint(const httplib::Request& req, const string& key, const Timetable& tt, Endpoint& e) {
+    if (req.has_param(key)) {
+        auto it = tt.name_to_id.find(req.get_param_value(key));
+        if (it == tt.name_to_id.end()) return false;
+        e.sid = it->second;
+        return true;
+    }
+    if (!req.has_param(key + "_lat") || !req.has_param(key + "_lon")) return false;
+    e.lat = atof(req.get_param_value(key + "_lat").c_str());
+    e.lon = atof(req.get_param_value(key + "_lon").c_str());
+    return true;
+}
+
+// Seeds or targets for one end: every platform of a named station, or every
+// stop in walking range of a point.
+void endpoint_seeds(const Endpoint& e, const Timetable& tt, vector<Seed>& out) {
+    if (e.sid < 0) {
+        point_access(e.lat, e.lon, tt, out);
+        return;
+    }
+    vector<int> station;
+    station_stops(tt, e.sid, station);
+    stop_access(station, tt, out);
+}
+
+void endpoint_targets(const Endpoint& e, const Timetable& tt, vector<Target>& out) {
+    if (e.sid < 0) {
+        point_egress(e.lat, e.lon, tt, out);
+        return;
+    }
+    vector<int> station;
+    station_stops(tt, e.sid, station);
+    stop_egress(station, tt, out);
+}
+
+// Cache key of a /calculate query: both ends and the departure bucket.
+string cache_key(const Endpoint& from, const Endpoint& to, int bucket) {
+    auto end = [](const Endpoint& e) { return e.sid >= 0 ? to_string(e.sid) : to_string(e.lat) + "," + to_string(e.lon); };
+    return end(from) + "|" + end(to) + "|" + to_string(bucket);
+}
+
+// One step of a journey: where it is, how it got there and when. trip is an
+// index into tt.trip_ids, or TRIP_WALK or TRIP_START.
+struct PathStep {
+    int sid, trip, secs;
+};
+
+constexpr int TRIP_WALK = -1, TRIP_START = -2;
+
+string method(const PathStep& step, const Timetable& tt) {
+    return step.trip >= 0 ? "Trip " + tt.trip_ids[step.trip] : step.trip == TRIP_WALK ? "Walk" : "Start";
+}
+
+// Steps of journey ji of ctx.profile from the origin, as (stop or point,
+// method, arrival), following pred() back from the destination. Returns the
+// time to leave the origin: the first trip's departure less the access walk to
+// it, or the query time for a journey on foot. The start step carries that
+// time, and every step before the first boarding (the access walk) is shifted
+// to match, so it reaches the first trip as it departs.
+int journey_path(const QueryContext& ctx, size_t ji, const Endpoint& from, const Endpoint& to, const Timetable& tt,
+    vector<PathStep>& path) {
+    path.clear();
+    Journey curr = ctx.profile[ji];
+    int curr_sid = ctx.profile_at[ji] >= 0 ? ctx.profile_at[ji] : to.sid >= 0 ? to.sid : DEST_PT;
+    int dep = ctx.start;
+    size_t access = 0; // path[access ..) comes before the first boarding
+
+    while (curr.from != -1) {
+        PathStep step = { curr_sid, TRIP_WALK, curr.arr.to_secs() };
+        int prev_sid = curr.from;
+        int prev_k = curr.meth.find("Walk") != string::npos ? curr.k : curr.k - 1;
+        if (curr.meth.compare(0, 5, "Trip ") == 0) {
+            uint32_t board = static_cast<uint32_t>(ctx.dp[curr.k][curr_sid]);
+            dep = tt.ev_dep[board] - (arr_of(ctx.dp[prev_k][prev_sid]) - ctx.start);
+            step.trip = tt.ev_trip[board];
+        }
+        path.push_back(step);
+        if (step.trip >= 0) access = path.size();
+
+        if (ctx.pred(prev_sid, prev_k, curr)) {
+            curr_sid = prev_sid;
+        }
+        else {
+            break;
+        }
+    }
+    if (from.sid < 0) path.push_back({ curr_sid, TRIP_WALK, curr.arr.to_secs() });
+    for (size_t i = access; i < path.size(); ++i) path[i].secs += dep - ctx.start;
+    path.push_back({ from.sid >= 0 ? curr_sid : ORIGIN_PT, TRIP_START, dep });
+    reverse(path.begin(), path.end());
+    return dep;
+}
+
+// /calculate's JSON: each journey's arrival (H:M), trips and steps with
+// stop names and coordinates, "partial" if the deadline cut the search short,
+// and the search's trace when there is one.
+void write_journeys_json(const QueryContext& ctx, const Endpoint& from, const Endpoint& to, const Timetable& tt,
+    string& out, const QueryTrace* trace = nullptr) {
+    JsonWriter w(out, 1024 + 2048 * ctx.profile.size());
+    w.begin_object().key("journeys").begin_array();
+    vector<PathStep> path;
+    for (size_t ji = 0; ji < ctx.profile.size(); ++ji) {
+        const Journey& j = ctx.profile[ji];
+        journey_path(ctx, ji, from, to, tt, path);
+        w.begin_object();
+        w.key("arrival").value(to_string(j.arr.h) + ":" + to_string(j.arr.m));
+        w.key("trips").value(j.k);
+        w.key("path").begin_array();
+        for (const auto& step : path) {
+            w.begin_object();
+            if (step.sid == ORIGIN_PT || step.sid == DEST_PT) {
+                const Endpoint& pt = step.sid == ORIGIN_PT ? from : to;
+                w.key("stop_name").value(step.sid == ORIGIN_PT ? "Origin" : "Destination");
+                w.key("lat").value(pt.lat).key("lon").value(pt.lon);
+            }
+            else {
+                const auto& s = tt.stops.at(step.sid);
+                w.key("stop_name").value(s.name);
+                w.key("lat").value(s.lat).key("lon").value(s.lon);
+            }
+            w.key("method").value(method(step, tt));
+            w.end_object();
+        }
+        w.end_array().end_object();
+    }
+    w.end_array();
+    if (ctx.partial) w.key("partial").value(true);
+    if (trace) {
+        w.key("trace").begin_object();
+        w.key("access_ms").value(trace->access_ms, 3).key("search_ms").value(trace->search_ms, 3);
+        w.key("rounds").begin_array();
+        for (size_t k = 0; k < trace->rounds.size(); ++k) {
+            const RoundTrace& r = trace->rounds[k];
+            w.begin_object().key("round").value(k + 1).key("marked").value(r.marked).key("trips").value(r.trips);
+            w.key("merged").value(r.merged).key("improved").value(r.improved);
+            w.key("queue_ms").value(r.queue_ms, 3).key("scan_ms").value(r.scan_ms, 3).key("merge_ms").value(r.merge_ms, 3);
+            w.end_object();
+        }
+        w.end_array().end_object();
+    }
+    w.end_object();
+}
+
+// The binary journey list, for clients that send Accept: application/x-tp-journeys.
+// Little-endian, 4-byte aligned, every offset counted from the first byte:
+//   u32 magic "TPJ1", u32 journey count n, u32 offset of the trip id table,
+//   u32 offset of each journey [n]
+//   journey: i32 departure, i32 arrival (seconds after midnight), u16 trips,
+//     u16 step count, then per step i32 stop id (-2 origin point, -3
+//     destination point), i32 trip (table index, -1 walk, -2 start),
+//     i32 arrival (the departure for the start step)
+//   trip id table: u32 count m, u32 end offset of each id within the bytes
+//     that follow [m], the ids' bytes
+// A reader can jump to any journey or trip id without parsing what precedes it.
+constexpr const char* JOURNEYS_BIN = "application/x-tp-journeys";
+
+void write_journeys_bin(const QueryContext& ctx, const Endpoint& from, const Endpoint& to, const Timetable& tt,
+    string& out) {
+    BinaryWriter w(out, 64 + 256 * ctx.profile.size());
+    size_t n = ctx.profile.size();
+    w.bytes("TPJ1").u32(static_cast<uint32_t>(n)).u32(0);
+    uint32_t table = w.pos();
+    for (size_t ji = 0; ji < n; ++ji) w.u32(0);
+
+    robin_hood::unordered_map<int, int> index; // trip -> table entry
+    vector<int> trips;
+    vector<PathStep> path;
+    for (size_t ji = 0; ji < n; ++ji) {
+        w.patch(table + 4 * static_cast<uint32_t>(ji), w.pos());
+        int dep = journey_path(ctx, ji, from, to, tt, path);
+        w.i32(dep).i32(ctx.profile[ji].arr.to_secs());
+        w.u16(static_cast<uint16_t>(ctx.profile[ji].k)).u16(static_cast<uint16_t>(path.size()));
+        for (const auto& step : path) {
+            int trip = step.trip;
+            if (trip >= 0) {
+                auto it = index.find(trip);
+                if (it == index.end()) {
+                    it = index.emplace(trip, static_cast<int>(trips.size())).first;
+                    trips.push_back(trip);
+                }
+                trip = it->second;
+            }
+            w.i32(step.sid).i32(trip).i32(step.secs);
+        }
+    }
+
+    w.patch(8, w.pos());
+    w.u32(static_cast<uint32_t>(trips.size()));
+    uint32_t end = 0;
+    for (int trip : trips) w.u32(end += static_cast<uint32_t>(tt.trip_ids[trip].size()));
+    for (int trip : trips) w.bytes(tt.trip_ids[trip]);
+    w.align();
+}
+
+string hhmmss(int secs) {
+    Time t = Time::from_secs(secs);
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%02d:%02d:%02d", t.h, t.m, t.s);
+    return buf;
+}
+
+enum class Engine { RAPTOR, TRIP_BASED, CSA };
+
+// Point-to-point search on the deployment's engine. Every engine fills ctx the
+// same way; transfer patterns, when loaded, answer first unless they find no
+// journey.
+// CSA returns the earliest journey only, and hands over to RAPTOR when that
+// takes more than MAX_K trips. RAPTOR keeps to the partition's corridors when
+// one is loaded and the query crosses cells.
+void route(Engine engine, const vector<Seed>& seeds, const vector<Target>& targets, const Time& start_t,
+    const Timetable& tt, const TripTransfers& tb, const Connections& cs, const TransferPatterns& patterns,
+    const Partition& part, QueryContext& ctx) {
+    if (patterns.loaded() && run_patterns(seeds, targets, start_t, tt, patterns, ctx)) return;
+    if (engine == Engine::TRIP_BASED) run_trip_based(seeds, targets, start_t, tt, tb, ctx);
+    else if (engine == Engine::CSA && run_csa(seeds, targets, start_t, tt, cs, ctx)) return;
+    else if (!part.loaded() || !run_partitioned(seeds, targets, start_t, tt, part, ctx)) run_raptor(seeds, targets, start_t, tt, ctx);
+}
+
+struct Options {
+    int workers = thread::hardware_concurrency();
+    QueryPool::Mode mode = QueryPool::ADAPTIVE;
+    string patterns; // transfer pattern file to answer /calculate from
+    string build_patterns; // write a transfer pattern file and exit
+    int pattern_step = 30; // minutes between sampled departures
+    Engine engine = Engine::RAPTOR;
+    string replay; // query log to run through every engine, then exit
+    string partition; // partition file restricting long-distance RAPTOR queries
+    string build_partition; // write a partition file and exit
+    int cells = 64;
+    int partition_step = 60; // minutes between sampled departures
+    size_t cache = 10000; // cached /calculate responses, 0 to disable
+    int cache_bucket = 1; // minutes of departure time sharing one cached response
+    int static_max_age = 3600; // seconds browsers may reuse web assets other than HTML
+    int http_threads = 0; // connections served at once, 0 for twice the workers (at least 8)
+    size_t http_queue = 256; // accepted connections waiting for an HTTP thread, 0 for no limit
+    size_t max_queued = 0; // queries waiting for a worker before 503, 0 for four per worker
+    int retry_after = 1; // seconds, sent with 503
+    size_t keep_alive = 100; // requests per connection
+    int keep_alive_timeout = 5; // idle seconds before a kept-alive connection closes
+    int read_timeout = 5, write_timeout = 5; // seconds
+    int deadline = 1000; // milliseconds a routing search may take, 0 for no limit
+};
+
+Options parse_args(int argc, char** argv) {
+    Options o;
+    for (int i = 1; i < argc; ++i) {
+        string a = argv[i];
+        if (a.rfind("--workers=", 0) == 0) o.workers = stoi(a.substr(10));
+        else if (a == "--mode=throughput") o.mode = QueryPool::THROUGHPUT;
+        else if (a == "--mode=adaptive") o.mode = QueryPool::ADAPTIVE;
+        else if (a.rfind("--patterns=", 0) == 0) o.patterns = a.substr(11);
+        else if (a.rfind("--build-patterns=", 0) == 0) o.build_patterns = a.substr(17);
+        else if (a.rfind("--pattern-step=", 0) == 0) o.pattern_step = stoi(a.substr(15));
+        else if (a == "--engine=raptor") o.engine = Engine::RAPTOR;
+        else if (a == "--engine=trip-based") o.engine = Engine::TRIP_BASED;
+        else if (a == "--engine=csa") o.engine = Engine::CSA;
+        else if (a.rfind("--replay=", 0) == 0) o.replay = a.substr(9);
+        else if (a.rfind("--partition=", 0) == 0) o.partition = a.substr(12);
+        else if (a.rfind("--build-partition=", 0) == 0) o.build_partition = a.substr(18);
+        else if (a.rfind("--cells=", 0) == 0) o.cells = stoi(a.substr(8));
+        else if (a.rfind("--partition-step=", 0) == 0) o.partition_step = stoi(a.substr(17));
+        else if (a.rfind("--cache=", 0) == 0) o.cache = stoul(a.substr(8));
+        else if (a.rfind("--cache-bucket=", 0) == 0) o.cache_bucket = max(1, stoi(a.substr(15)));
+        else if (a.rfind("--static-max-age=", 0) == 0) o.static_max_age = stoi(a.substr(17));
+        else if (a.rfind("--http-threads=", 0) == 0) o.http_threads = stoi(a.substr(15));
+        else if (a.rfind("--http-queue=", 0) == 0) o.http_queue = stoul(a.substr(13));
+        else if (a.rfind("--max-queued=", 0) == 0) o.max_queued = stoul(a.substr(13));
+        else if (a.rfind("--retry-after=", 0) == 0) o.retry_after = stoi(a.substr(14));
+        else if (a.rfind("--keep-alive=", 0) == 0) o.keep_alive = stoul(a.substr(13));
+        else if (a.rfind("--keep-alive-timeout=", 0) == 0) o.keep_alive_timeout = stoi(a.substr(21));
+        else if (a.rfind("--read-timeout=", 0) == 0) o.read_timeout = stoi(a.substr(15));
+        else if (a.rfind("--write-timeout=", 0) == 0) o.write_timeout = stoi(a.substr(16));
+        else if (a.rfind("--deadline=", 0) == 0) o.deadline = stoi(a.substr(11));
+        else cerr << "Ignoring unknown option " << a << endl;
     }
+    return o;
+}
 
-    for (auto const& [tid, sched] : trips) {
-        for (const auto& st : sched) {
-            routes_at_stop[st.sid].push_back(tid);
+// Journeys of ctx.profile whose access walk does not reach the first trip as
+// it leaves: the step before the first boarding must arrive at the trip's
+// departure from that stop, the start step's time plus the walk.
+int access_mismatches(const QueryContext& ctx, const Endpoint& from, const Endpoint& to, const Timetable& tt) {
+    vector<PathStep> path;
+    int bad = 0;
+    for (size_t ji = 0; ji < ctx.profile.size(); ++ji) {
+        journey_path(ctx, ji, from, to, tt, path);
+        size_t i = 1;
+        while (i < path.size() && path[i].trip < 0) ++i;
+        if (i == path.size()) continue;
+        const PathStep& at = path[i - 1];
+        bool boards = false;
+        for (int e = tt.trip_first[path[i].trip]; e < tt.trip_first[path[i].trip + 1]; ++e) {
+            if (tt.ev_sid[e] == at.sid && tt.ev_dep[e] == at.secs) boards = true;
         }
+        if (!boards) ++bad;
     }
+    return bad;
+}
 
-    ifstream transfers_file(dir + "/transfers.txt");
-    getline(transfers_file, line);
-    while (getline(transfers_file, line)) {
+// A/B run over a query log of "start|end|HH:MM" lines (stop names): every
+// query goes through each engine on one context and the timings are reported.
+// Trip-Based must match RAPTOR's profile exactly; CSA only answers earliest
+// arrival, so it must match the earliest RAPTOR journey (falling back to
+// RAPTOR, as route() does, when that journey takes more than MAX_K trips).
+// With a partition loaded, the partitioned search runs too; it may miss
+// journeys through cells outside its corridors. RAPTOR's journeys are also
+// checked to reach their first trip as it departs (access_mismatches).
+int replay(const string& path, const Timetable& tt, const TripTransfers& tb, const Connections& cs,
+    const Partition& part) {
+    ifstream in(path);
+    if (!in) {
+        cerr << "Could not read " << path << endl;
+        return 1;
+    }
+    const char* names[] = { "raptor", "trip-based", "csa", "partitioned" };
+    int engines = part.loaded() ? 4 : 3;
+    vector<double> ms[4];
+    int n = 0, differ[4] = {}, too_many = 0, access_off = 0;
+    QueryContext ctx;
+    ctx.reserve(tt);
+    string line;
+    while (getline(in, line)) {
         stringstream ss(line);
-        string field;
-        Transfer t;
-        getline(ss, field, ','); t.u = stoi(field);
-        getline(ss, field, ','); t.v = stoi(field);
-        getline(ss, field, ',');
-        getline(ss, field, ','); t.dur = stoi(field);
-        transfers[t.u].push_back(t);
+        string a, b, t;
+        getline(ss, a, '|');
+        getline(ss, b, '|');
+        getline(ss, t);
+        auto ia = tt.name_to_id.find(a), ib = tt.name_to_id.find(b);
+        if (ia == tt.name_to_id.end() || ib == tt.name_to_id.end()) continue;
+        Time start_t = { 0, 0, 0 };
+        sscanf(t.c_str(), "%d:%d", &start_t.h, &start_t.m);
+        Endpoint from, to;
+        from.sid = ia->second;
+        to.sid = ib->second;
+        vector<Seed> seeds;
+        vector<Target> targets;
+        endpoint_seeds(from, tt, seeds);
+        endpoint_targets(to, tt, targets);
+
+        vector<pair<int, int>> result[4];
+        for (int e = 0; e < engines; ++e) {
+            auto t0 = chrono::steady_clock::now();
+            if (e == 0) run_raptor(seeds, targets, start_t, tt, ctx);
+            else if (e == 1) run_trip_based(seeds, targets, start_t, tt, tb, ctx);
+            else if (e == 2 && !run_csa(seeds, targets, start_t, tt, cs, ctx)) {
+                ++too_many;
+                run_raptor(seeds, targets, start_t, tt, ctx);
+            }
+            else if (e == 3 && !run_partitioned(seeds, targets, start_t, tt, part, ctx)) run_raptor(seeds, targets, start_t, tt, ctx);
+            ms[e].push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count());
+            for (const auto& j : ctx.profile) result[e].push_back({ j.arr.to_secs(), j.k });
+            if (e == 0 && access_mismatches(ctx, from, to, tt)) {
+                ++access_off;
+                cout << "  access walk misses the first trip: " << line << endl;
+            }
+        }
+        if (result[1] != result[0]) {
+            ++differ[1];
+            cout << "  trip-based differs: " << line << endl;
+        }
+        int raptor_first = result[0].empty() ? INF_T : result[0][0].first;
+        int csa_first = result[2].empty() ? INF_T : result[2][0].first;
+        if (csa_first != raptor_first) {
+            ++differ[2];
+            cout << "  csa differs: " << line << endl;
+        }
+        if (engines == 4 && result[3] != result[0]) {
+            ++differ[3];
+            cout << "  partitioned differs: " << line << endl;
+        }
+        ++n;
+    }
+    cout << n << " queries; profile differs for trip-based on " << differ[1] << ", earliest arrival for csa on "
+        << differ[2] << " (" << too_many << " needing more than " << MAX_K << " trips)";
+    if (engines == 4) cout << ", profile for partitioned on " << differ[3];
+    cout << "; access walk off on " << access_off << endl;
+    for (int e = 0; e < engines && n; ++e) {
+        double sum = 0;
+        for (double v : ms[e]) sum += v;
+        sort(ms[e].begin(), ms[e].end());
+        cout << "  " << names[e] << ": mean " << sum / n << " ms, p50 " << ms[e][n / 2]
+            << " ms, p99 " << ms[e][min<size_t>(n - 1, n * 99 / 100)] << " ms" << endl;
     }
-    cout << "GTFS data loaded." << endl;
+    return 0;
 }
 
-int main() {
-    robin_hood::unordered_map<int, Stop> stops;
-    robin_hood::unordered_map<string, vector<StopTime>> trips;
-    robin_hood::unordered_map<int, vector<Transfer>> transfers;
-    robin_hood::unordered_map<int, vector<string>> routes_at_stop;
-    robin_hood::unordered_map<string, int> name_to_id;
+int main(int argc, char** argv) {
+    Options opt = parse_args(argc, argv);
 
-    load_data("text", stops, trips, transfers, routes_at_stop, name_to_id);
+    Timetable tt;
+    auto load_start = chrono::steady_clock::now();
+    load_data("text", tt);
+    double load_secs = chrono::duration<double>(chrono::steady_clock::now() - load_start).count();
 
+    if (!opt.build_patterns.empty()) {
+        PatternStats st;
+        if (!build_patterns(tt, opt.pattern_step, opt.build_patterns, st)) {
+            cerr << "Could not write " << opt.build_patterns << endl;
+            return 1;
+        }
+        cout << "Transfer patterns: " << st.nodes << " nodes, " << st.ends << " pattern ends, "
+            << st.bytes / (1024.0 * 1024.0) << " MiB, built in " << st.secs << " s" << endl;
+        return 0;
+    }
+    TripTransfers tb;
+    if (opt.engine == Engine::TRIP_BASED || !opt.replay.empty()) {
+        build_trip_transfers(tt, tb);
+        cout << "Trip transfers: " << tb.tr_to.size() << " kept of " << tb.candidates << " over "
+            << tb.n_lines() << " lines, built in " << tb.secs << " s" << endl;
+    }
+    Connections cs;
+    if (opt.engine == Engine::CSA || !opt.replay.empty()) {
+        build_connections(tt, cs);
+        cout << "Connections: " << cs.conns.size() << endl;
+    }
+    if (!opt.build_partition.empty()) {
+        PartitionStats st;
+        if (!build_partition(tt, opt.cells, opt.partition_step, opt.build_partition, st)) {
+            cerr << "Could not write " << opt.build_partition << endl;
+            return 1;
+        }
+        cout << "Partition: " << opt.cells << " cells, " << st.border << " border stops, corridors cover "
+            << st.corridor_share * 100 << "% of cells on average, built in " << st.secs << " s" << endl;
+        return 0;
+    }
+    Partition part;
+    if (!opt.partition.empty()) {
+        if (!part.open(opt.partition, tt)) {
+            cerr << "Could not load " << opt.partition << endl;
+            return 1;
+        }
+        cout << "Partition: " << part.n_cells << " cells" << endl;
+    }
+    if (!opt.replay.empty()) return replay(opt.replay, tt, tb, cs, part);
+
+    TransferPatterns patterns;
+    if (!opt.patterns.empty()) {
+        if (!patterns.open(opt.patterns, tt)) {
+            cerr << "Could not load " << opt.patterns << endl;
+            return 1;
+        }
+        cout << "Transfer patterns: " << patterns.bytes() / (1024.0 * 1024.0) << " MiB mapped" << endl;
+    }
+
+    int workers = max(1, opt.workers);
+    size_t max_queued = opt.max_queued ? opt.max_queued : 4 * static_cast<size_t>(workers);
+    QueryPool pool(workers, opt.mode, max_queued);
+    cout << "Scan kernel: " << scan_kernel().name << endl;
+    ResultCache cache(opt.cache, 16);
+
+    // Each kept-alive connection holds an HTTP thread, and a thread waiting on
+    // a query holds it too, so there are more of them than workers; past
+    // http_queue waiting connections httplib drops new ones. A query that
+    // would wait behind max_queued others is turned away with 503 instead of
+    // letting every response slow down.
     httplib::Server svr;
-    svr.set_mount_point("/", "./web");
+    size_t http_threads = opt.http_threads > 0 ? opt.http_threads : max(8, 2 * workers);
+    svr.new_task_queue = [&] { return new httplib::ThreadPool(http_threads, opt.http_queue); };
+    svr.set_keep_alive_max_count(opt.keep_alive).set_keep_alive_timeout(opt.keep_alive_timeout);
+    svr.set_read_timeout(opt.read_timeout).set_write_timeout(opt.write_timeout);
+    svr.set_exception_handler([&](const httplib::Request&, httplib::Response& res, exception_ptr ep) {
+        string json;
+        JsonWriter w(json);
+        try {
+            rethrow_exception(ep);
+        }
+        catch (const QueryPool::Saturated&) {
+            res.status = 503;
+            res.set_header("Retry-After", to_string(opt.retry_after));
+            w.begin_object().key("error").value("Server busy").end_object();
+        }
+        catch (const exception& e) {
+            res.status = 500;
+            w.begin_object().key("error").value(e.what()).end_object();
+        }
+        catch (...) {
+            res.status = 500;
+            w.begin_object().key("error").value("Internal error").end_object();
+        }
+        res.set_content(json, "application/json");
+        });
+
+    // Requests are counted by route and status class and timed from routing to
+    // the last byte written, streamed bodies included.
+    Metrics metrics;
+    const vector<uint64_t> latency_us = { 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000,
+        500000, 1000000, 2500000 };
+    struct EndpointMetrics {
+        Metrics::Id status[4], latency; // status: 2xx to 5xx
+    };
+    robin_hood::unordered_map<string, EndpointMetrics> by_route;
+    for (string route : { "/hi", "/calculate", "/batch", "/api/stops", "/api/autocomplete", "/api/route", "/stats",
+        "/metrics", "/matrix", "/isochrone", "/departures", "static", "other" }) {
+        string labels = "endpoint=\"" + route + "\"";
+        EndpointMetrics& m = by_route[route];
+        for (int c = 0; c < 4; ++c) {
+            m.status[c] = metrics.counter("tp_http_requests_total", "HTTP requests by endpoint and status class.",
+                labels + ",code=\"" + to_string(c + 2) + "xx\"");
+        }
+        m.latency = metrics.histogram("tp_http_request_duration_seconds", "HTTP request latency by endpoint.",
+            latency_us, 1e6, labels);
+    }
+    const EndpointMetrics unrouted = by_route["other"];
+    Metrics::Id query_us = metrics.histogram("tp_query_duration_seconds", "Routing search time, queueing excluded.",
+        latency_us, 1e6);
+    Metrics::Id query_rounds = metrics.histogram("tp_query_rounds", "Rounds run per routing search.", { 0, 1, 2, 3, 4, 5 });
+    Metrics::Id query_scanned = metrics.histogram("tp_query_scanned",
+        "Trips (Trip-Based: trip segments, CSA: connections) scanned per routing search.",
+        { 100, 300, 1000, 3000, 10000, 30000, 100000, 300000, 1000000 });
+    Metrics::Id query_labels = metrics.histogram("tp_query_labels", "Labels stored per routing search.",
+        { 100, 300, 1000, 3000, 10000, 30000, 100000, 300000, 1000000 });
+    Metrics::Id query_partial = metrics.counter("tp_query_partial_total", "Routing searches cut short by the deadline.");
+    metrics.counter("tp_cache_hits_total", "Result cache hits.", [&] { return static_cast<double>(cache.hits()); });
+    metrics.counter("tp_cache_misses_total", "Result cache misses.", [&] { return static_cast<double>(cache.misses()); });
+    metrics.gauge("tp_cache_hit_ratio", "Result cache hits over lookups since startup.", [&] {
+        uint64_t hits = cache.hits(), misses = cache.misses();
+        return hits + misses ? static_cast<double>(hits) / (hits + misses) : 0.0;
+        });
+    metrics.gauge("tp_cache_entries", "Responses in the result cache.", [&] { return static_cast<double>(cache.size()); });
+    metrics.gauge("tp_timetable_load_seconds", "Time to load the GTFS feed at startup.", [=] { return load_secs; });
+    metrics.gauge("tp_timetable_stops", "Stops in the timetable.", [&] { return static_cast<double>(tt.stops.size()); });
+    metrics.gauge("tp_timetable_trips", "Trips in the timetable.", [&] { return static_cast<double>(tt.n_trips()); });
+
+    svr.set_pre_routing_handler([](const httplib::Request&, httplib::Response&) {
+        request_start = chrono::steady_clock::now();
+        return httplib::Server::HandlerResponse::Unhandled;
+        });
+    svr.set_logger([&](const httplib::Request& req, const httplib::Response& res) {
+        auto us = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - request_start).count();
+        auto it = by_route.find(req.matched_route == R"(/.*)" ? string("static") : req.matched_route);
+        const EndpointMetrics& m = it != by_route.end() ? it->second : unrouted;
+        if (res.status >= 200 && res.status < 600) metrics.add(m.status[res.status / 100 - 2]);
+        metrics.observe(m.latency, static_cast<uint64_t>(us));
+        });
+
+    svr.Get("/metrics", [&](const httplib::Request&, httplib::Response& res) {
+        res.set_content(metrics.expose(), "text/plain; version=0.0.4");
+        });
 
     svr.Get("/hi", [](const httplib::Request&, httplib::Response& res) {
         res.set_content("Hello World!", "text/plain");
         });
 
+    // A name covers every platform of the station; a point snaps to every stop
+    // in walking range. Either way it is one search, cut short at the deadline.
+    auto deadline_from_now = [&] {
+        return opt.deadline > 0 ? chrono::steady_clock::now() + chrono::milliseconds(opt.deadline)
+            : chrono::steady_clock::time_point::max();
+    };
+    auto search = [&](const Endpoint& from, const Endpoint& to, const Time& start_t,
+        chrono::steady_clock::time_point deadline, QueryContext& ctx) {
+        ctx.reserve(tt);
+        ctx.deadline = deadline;
+        auto t0 = chrono::steady_clock::now();
+        vector<Seed> seeds;
+        vector<Target> targets;
+        endpoint_seeds(from, tt, seeds);
+        endpoint_targets(to, tt, targets);
+        auto t1 = chrono::steady_clock::now();
+        route(opt.engine, seeds, targets, start_t, tt, tb, cs, patterns, part, ctx);
+        auto t2 = chrono::steady_clock::now();
+        metrics.observe(query_us, chrono::duration_cast<chrono::microseconds>(t2 - t1).count());
+        if (ctx.trace) {
+            ctx.trace->access_ms = chrono::duration<double, milli>(t1 - t0).count();
+            ctx.trace->search_ms = chrono::duration<double, milli>(t2 - t1).count();
+        }
+        metrics.observe(query_rounds, ctx.rounds);
+        metrics.observe(query_scanned, ctx.scanned);
+        metrics.observe(query_labels, ctx.labels);
+        if (ctx.partial) metrics.add(query_partial);
+    };
+
+    // With the cache on, every departure in a cache bucket is answered as if
+    // leaving at its last minute, so one cached response is valid for all of
+    // them; with it off, each departs at its own time. write()
+    // serialises the search results in the endpoint's format. The deadline
+    // counts from the request's arrival, queueing included; a search it cut
+    // short is marked with X-Partial and not cached.
+    auto cached_route = [&](const string& format, const Endpoint& from, const Endpoint& to, Time start_t,
+        const function<void(const QueryContext&, string&)>& write, httplib::Response& res) {
+        auto deadline = deadline_from_now();
+        int bucket = (start_t.h * 60 + start_t.m) / opt.cache_bucket;
+        if (cache.enabled() && opt.cache_bucket > 1) start_t = Time::from_secs((bucket * opt.cache_bucket + opt.cache_bucket - 1) * 60);
+        string key = format + "|" + cache_key(from, to, bucket), body;
+        if (cache.get(key, body)) return body;
+
+        bool partial = false;
+        body = pool.run([&](QueryContext& ctx) {
+            search(from, to, start_t, deadline, ctx);
+            partial = ctx.partial;
+            string body;
+            write(ctx, body);
+            return body;
+            });
+        if (partial) res.set_header("X-Partial", "true");
+        else cache.put(key, body);
+        return body;
+    };
+
     svr.Post("/calculate", [&](const httplib::Request& req, httplib::Response& res) {
-        string start_name = req.get_param_value("start");
-        string end_name = req.get_param_value("end");
-        Time start_t;
-        sscanf(req.get_param_value("time").c_str(), "%d:%d", &start_t.h, &start_t.m);
-        start_t.s = 0;
+        Time start_t = { 0, 0, 0 };
+        if (!parse_time(req.get_param_value("time"), start_t)) {
+            res.status = 400;
+            res.set_content("{\"error\":\"Invalid time\"}", "application/json");
+            return;
+        }
 
-        if (name_to_id.find(start_name) == name_to_id.end() ||
-            name_to_id.find(end_name) == name_to_id.end()) {
+        Endpoint from, to;
+        if (!parse_endpoint(req, "start", tt, from) || !parse_endpoint(req, "end", tt, to)) {
             res.set_content("{\"error\":\"Invalid stop name\"}", "application/json");
             return;
         }
 
-        int src = name_to_id[start_name];
-        int dest = name_to_id[end_name];
-
-        robin_hood::unordered_map<int, vector<Journey>> profiles;
-        robin_hood::unordered_map<int, robin_hood::unordered_map<int, Journey>> preds;
-        run_raptor(src, dest, start_t, stops, transfers, trips, routes_at_stop, profiles, preds);
-
-        string json = "{\"journeys\":[";
-        if (profiles.count(dest)) {
-            bool first_j = true;
-            for (const auto& j : profiles.at(dest)) {
-                if (!first_j) json += ",";
-                json += "{";
-                json += "\"arrival\":\"" + to_string(j.arr.h) + ":" + to_string(j.arr.m) + "\",";
-                json += "\"trips\":" + to_string(j.k) + ",";
-                json += "\"path\":[";
-
-                vector<pair<int, string>> path;
-                Journey curr = j;
-                int curr_sid = dest;
-
-                while (curr.from != -1) {
-                    path.push_back({ curr_sid, curr.meth });
-                    int prev_sid = curr.from;
-                    int prev_k = curr.meth.find("Walk") != string::npos ? curr.k : curr.k - 1;
-
-                    if (preds.count(prev_sid) && preds.at(prev_sid).count(prev_k)) {
-                        curr = preds.at(prev_sid).at(prev_k);
-                        curr_sid = prev_sid;
-                    }
-                    else {
-                        break;
-                    }
+        if (accepts(req.get_header_value("Accept"), JOURNEYS_BIN, false)) {
+            res.set_content(cached_route("calculate.bin", from, to, start_t, [&](const QueryContext& ctx, string& out) {
+                write_journeys_bin(ctx, from, to, tt, out);
+                }, res), JOURNEYS_BIN);
+            return;
+        }
+        // A traced query is searched afresh, never cached: the trace is the point.
+        if (req.get_param_value("trace") == "1" || req.get_header_value("X-Trace") == "1") {
+            auto deadline = deadline_from_now();
+            res.set_content(pool.run([&](QueryContext& ctx) {
+                QueryTrace trace;
+                ctx.trace = &trace;
+                search(from, to, start_t, deadline, ctx);
+                string json;
+                write_journeys_json(ctx, from, to, tt, json, &trace);
+                return json;
+                }), "application/json");
+            return;
+        }
+        string json = cached_route("calculate", from, to, start_t, [&](const QueryContext& ctx, string& out) {
+            write_journeys_json(ctx, from, to, tt, out);
+            }, res);
+        res.set_content(json, "application/json");
+        });
+
+    // A query log in one request: the body holds `start|end|HH:MM` lines, as
+    // --replay reads them. A few lines per worker are searched at a time and
+    // streamed back in order as {"results":[...]}, one /calculate object or
+    // error per line. The cache is bypassed, so each line keeps its own minute.
+    // The batch is admitted as a whole; its window is what keeps it from
+    // crowding out other queries.
+    struct BatchQuery {
+        Endpoint from, to;
+        Time start_t;
+        const char* error; // why the line was not searched, or null
+    };
+    struct Batch {
+        shared_ptr<vector<BatchQuery>> queries = make_shared<vector<BatchQuery>>();
+        deque<future<string>> running; // in line order
+        size_t next = 0;
+    };
+    size_t batch_window = 2 * static_cast<size_t>(workers);
+
+    svr.Post("/batch", [&](const httplib::Request& req, httplib::Response& res) {
+        pool.admit();
+        auto batch = make_shared<Batch>();
+        stringstream in(req.body);
+        string line;
+        while (getline(in, line)) {
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (line.empty()) continue;
+            stringstream ss(line);
+            string a, b, t;
+            getline(ss, a, '|');
+            getline(ss, b, '|');
+            getline(ss, t);
+            BatchQuery q = { {}, {}, { 0, 0, 0 }, "Invalid stop name" };
+            auto ia = tt.name_to_id.find(a), ib = tt.name_to_id.find(b);
+            if (ia != tt.name_to_id.end() && ib != tt.name_to_id.end()) {
+                q.from.sid = ia->second;
+                q.to.sid = ib->second;
+                q.error = parse_time(t, q.start_t) ? nullptr : "Invalid time";
+            }
+            batch->queries->push_back(q);
+        }
+
+        // The tasks share the queries, so a client that goes away mid-batch
+        // leaves nothing dangling.
+        res.set_chunked_content_provider("application/json",
+            [&, batch, chunk = string()](size_t, httplib::DataSink& sink) mutable {
+                auto& running = batch->running;
+                bool first = batch->next == 0;
+                while (batch->next < batch->queries->size() && running.size() < batch_window) {
+                    running.push_back(pool.async([&, queries = batch->queries, i = batch->next++](QueryContext& ctx) {
+                        const BatchQuery& q = (*queries)[i];
+                        string out;
+                        if (q.error) return "{\"error\":\"" + string(q.error) + "\"}";
+                        search(q.from, q.to, q.start_t, deadline_from_now(), ctx);
+                        write_journeys_json(ctx, q.from, q.to, tt, out);
+                        return out;
+                        }, false));
                 }
-                path.push_back({ src, "Start" });
-                reverse(path.begin(), path.end());
-
-                bool first_s = true;
-                for (const auto& step : path) {
-                    if (!first_s) json += ",";
-                    const auto& s = stops.at(step.first);
-                    json += "{";
-                    json += "\"stop_name\":\"" + s.name + "\",";
-                    json += "\"lat\":" + to_string(s.lat) + ",";
-                    json += "\"lon\":" + to_string(s.lon) + ",";
-                    json += "\"method\":\"" + step.second + "\"";
-                    json += "}";
-                    first_s = false;
+                chunk = first ? "{\"results\":[" : ",";
+                if (running.empty()) {
+                    chunk = first ? "{\"results\":[]}" : "]}";
+                    bool ok = sink.write(chunk.data(), chunk.size());
+                    sink.done();
+                    return ok;
                 }
-                json += "]}";
-                first_j = false;
+                chunk += running.front().get();
+                running.pop_front();
+                return sink.write(chunk.data(), chunk.size());
+            });
+        });
+
+    // The web UI's API: stops by id, times as HH:MM:SS.
+    Precompressed stops_blob;
+    {
+        vector<int> ids;
+        for (const auto& p : tt.stops) ids.push_back(p.first);
+        sort(ids.begin(), ids.end());
+        string json;
+        JsonWriter w(json, 96 * ids.size());
+        w.begin_array();
+        for (int sid : ids) {
+            const Stop& s = tt.stops.at(sid);
+            w.begin_object().key("id").value(s.id).key("name").value(s.name);
+            w.key("lat").value(s.lat).key("lon").value(s.lon).end_object();
+        }
+        w.end_array();
+        stops_blob.build(move(json));
+        cout << "Stop list: " << stops_blob.identity.size() << " bytes, " << stops_blob.gzip.size() << " gzipped, "
+            << stops_blob.br.size() << " brotli" << endl;
+    }
+
+    svr.Get("/api/stops", [&](const httplib::Request& req, httplib::Response& res) {
+        const char* encoding;
+        const string& body = stops_blob.pick(req.get_header_value("Accept-Encoding"), encoding);
+        res.set_header("Vary", "Accept-Encoding");
+        if (*encoding) res.set_header("Content-Encoding", encoding);
+        res.set_content(body, "application/json");
+        });
+
+    Autocomplete names;
+    names.build(tt);
+
+    svr.Get("/api/autocomplete", [&](const httplib::Request& req, httplib::Response& res) {
+        int n = req.has_param("n") ? atoi(req.get_param_value("n").c_str()) : 10;
+        vector<int> found;
+        names.find(req.get_param_value("q"), min(max(n, 0), 50), found);
+        string json;
+        JsonWriter w(json, 96 * found.size() + 2);
+        w.begin_array();
+        for (int sid : found) {
+            const Stop& s = tt.stops.at(sid);
+            w.begin_object().key("id").value(s.id).key("name").value(s.name);
+            w.key("lat").value(s.lat).key("lon").value(s.lon).end_object();
+        }
+        w.end_array();
+        res.set_content(json, "application/json");
+        });
+
+    svr.Get("/api/route", [&](const httplib::Request& req, httplib::Response& res) {
+        vector<int> a, b;
+        if (!parse_ids(req.get_param_value("from"), tt, a) || !parse_ids(req.get_param_value("to"), tt, b) ||
+            a.size() != 1 || b.size() != 1) {
+            res.set_content("{\"error\":\"Invalid stop id\"}", "application/json");
+            return;
+        }
+        Time start_t = { 0, 0, 0 };
+        if (!parse_time(req.get_param_value("time"), start_t)) {
+            res.status = 400;
+            res.set_content("{\"error\":\"Invalid time\"}", "application/json");
+            return;
+        }
+        Endpoint from, to;
+        from.sid = a[0];
+        to.sid = b[0];
+
+        if (accepts(req.get_header_value("Accept"), JOURNEYS_BIN, false)) {
+            res.set_content(cached_route("api.bin", from, to, start_t, [&](const QueryContext& ctx, string& out) {
+                write_journeys_bin(ctx, from, to, tt, out);
+                }, res), JOURNEYS_BIN);
+            return;
+        }
+        string json = cached_route("api", from, to, start_t, [&](const QueryContext& ctx, string& out) {
+            JsonWriter w(out, 1024 + 2048 * ctx.profile.size());
+            w.begin_object().key("results").begin_array();
+            vector<PathStep> path;
+            for (size_t ji = 0; ji < ctx.profile.size(); ++ji) {
+                int dep = journey_path(ctx, ji, from, to, tt, path);
+                w.begin_object();
+                w.key("departure_time").value(hhmmss(dep));
+                w.key("arrival_time").value(hhmmss(ctx.profile[ji].arr.to_secs()));
+                w.key("trips").value(ctx.profile[ji].k);
+                w.key("path").begin_array();
+                for (const auto& step : path) w.begin_object().key("stop_id").value(step.sid).key("method").value(method(step, tt)).end_object();
+                w.end_array().end_object();
             }
+            w.end_array();
+            if (ctx.partial) w.key("partial").value(true);
+            w.end_object();
+            }, res);
+        res.set_content(json, "application/json");
+        });
+
+    svr.Get("/stats", [&](const httplib::Request&, httplib::Response& res) {
+        uint64_t hits = cache.hits(), misses = cache.misses();
+        string json;
+        JsonWriter w(json);
+        w.begin_object().key("cache").begin_object();
+        w.key("entries").value(cache.size()).key("hits").value(hits).key("misses").value(misses);
+        w.key("hit_rate").value(hits + misses ? static_cast<double>(hits) / (hits + misses) : 0.0);
+        w.end_object().end_object();
+        res.set_content(json, "application/json");
+        });
+
+    // Origin-destination travel times in seconds: one one-to-all search per
+    // origin, spread over the query pool.
+    svr.Post("/matrix", [&](const httplib::Request& req, httplib::Response& res) {
+        vector<int> origins, dests;
+        if (!parse_ids(req.get_param_value("origins"), tt, origins) ||
+            !parse_ids(req.get_param_value("destinations"), tt, dests)) {
+            res.set_content("{\"error\":\"Invalid stop id\"}", "application/json");
+            return;
+        }
+        Time start_t = { 0, 0, 0 };
+        if (!parse_time(req.get_param_value("time"), start_t)) {
+            res.status = 400;
+            res.set_content("{\"error\":\"Invalid time\"}", "application/json");
+            return;
         }
-        json += "]}";
+
+        // Admitted as a whole: a refusal halfway would leave tasks referencing
+        // this frame.
+        pool.admit();
+        vector<future<string>> rows;
+        rows.reserve(origins.size());
+        for (int src : origins) {
+            rows.push_back(pool.async([&, src](QueryContext& ctx) {
+                ctx.reserve(tt);
+                run_one_to_all(src, start_t, tt, ctx);
+                string row;
+                JsonWriter w(row, 8 * dests.size() + 2);
+                w.begin_array();
+                for (int d : dests) {
+                    int a = ctx.arrival(d);
+                    if (a == INF_T) w.null();
+                    else w.value(a - ctx.start);
+                }
+                w.end_array();
+                return row;
+                }, false));
+        }
+        // The tasks reference this frame, so let every one finish before collecting.
+        for (auto& r : rows) r.wait();
+
+        string json;
+        JsonWriter w(json, 64 + 8 * (origins.size() + dests.size()) * (1 + origins.size()));
+        w.begin_object().key("origins").begin_array();
+        for (int o : origins) w.value(o);
+        w.end_array().key("destinations").begin_array();
+        for (int d : dests) w.value(d);
+        w.end_array().key("durations").begin_array();
+        for (auto& r : rows) w.raw(r.get());
+        w.end_array().end_object();
         res.set_content(json, "application/json");
         });
 
+    // Stops reachable within `budget` minutes plus banded walking areas, streamed
+    // as it is serialised so large budgets don't build one huge string.
+    svr.Get("/isochrone", [&](const httplib::Request& req, httplib::Response& res) {
+        vector<int> src;
+        if (!parse_ids(req.get_param_value("stop"), tt, src) || src.size() != 1) {
+            res.set_content("{\"error\":\"Invalid stop id\"}", "application/json");
+            return;
+        }
+        Time start_t = { 0, 0, 0 };
+        if (!parse_time(req.get_param_value("time"), start_t)) {
+            res.status = 400;
+            res.set_content("{\"error\":\"Invalid time\"}", "application/json");
+            return;
+        }
+        int budget = req.has_param("budget") ? atoi(req.get_param_value("budget").c_str()) : 45;
+        int bucket = req.has_param("bucket") ? atoi(req.get_param_value("bucket").c_str()) : 15;
+        if (budget <= 0 || bucket <= 0) {
+            res.set_content("{\"error\":\"Invalid budget\"}", "application/json");
+            return;
+        }
+
+        auto iso = make_shared<Isochrone>();
+        pool.run([&](QueryContext& ctx) {
+            ctx.reserve(tt);
+            build_isochrone(src[0], start_t, budget * 60, bucket * 60, tt, ctx, *iso);
+            });
+
+        res.set_chunked_content_provider("application/json",
+            [&tt, iso, part = size_t(0), chunk = string()](size_t, httplib::DataSink& sink) mutable {
+                if (!isochrone_chunk(*iso, tt, part++, chunk)) {
+                    sink.done();
+                    return true;
+                }
+                return sink.write(chunk.data(), chunk.size());
+            });
+        });
+
+    // Next departures from one stop: a binary search in its departure-sorted
+    // events, answered on the HTTP thread without a query worker.
+    svr.Get("/departures", [&](const httplib::Request& req, httplib::Response& res) {
+        vector<int> stop;
+        if (!parse_ids(req.get_param_value("stop"), tt, stop) || stop.size() != 1) {
+            res.set_content("{\"error\":\"Invalid stop id\"}", "application/json");
+            return;
+        }
+        Time start_t = { 0, 0, 0 };
+        if (!parse_time(req.get_param_value("time"), start_t)) {
+            res.status = 400;
+            res.set_content("{\"error\":\"Invalid time\"}", "application/json");
+            return;
+        }
+        int n = req.has_param("n") ? atoi(req.get_param_value("n").c_str()) : 10;
+        if (n <= 0) {
+            res.status = 400;
+            res.set_content("{\"error\":\"Invalid count\"}", "application/json");
+            return;
+        }
+        vector<int> evs;
+        next_departures(tt, stop[0], start_t.to_secs(), min(n, 100), evs);
+
+        string json;
+        JsonWriter w(json, 64 + 96 * evs.size());
+        w.begin_object().key("stop_name").value(tt.stops.at(stop[0]).name).key("departures").begin_array();
+        for (int e : evs) {
+            int t = tt.ev_trip[e];
+            Time d = Time::from_secs(tt.ev_dep[e]);
+            char hhmm[16];
+            snprintf(hhmm, sizeof(hhmm), "%02d:%02d", d.h, d.m);
+            w.begin_object().key("time").value(hhmm).key("trip").value(tt.trip_ids[t]);
+            w.key("route").value(tt.trip_route[t]).key("headsign").value(tt.trip_headsign[t]).end_object();
+        }
+        w.end_array().end_object();
+        res.set_content(json, "application/json");
+        });
+
+    // Everything else is the web UI, from memory. Registered last, so the API
+    // routes above match first.
+    StaticAssets assets;
+    size_t n_assets = assets.load("./web", opt.static_max_age);
+    cout << "Web assets: " << n_assets << " files, " << assets.bytes() << " bytes with compressed forms" << endl;
+    svr.Get(R"(/.*)", [&](const httplib::Request& req, httplib::Response& res) {
+        if (!assets.serve(req, res)) res.status = 404;
+        });
+
+    cout << "HTTP: " << http_threads << " threads for " << workers << " query workers, 503 past "
+        << max_queued << " queued queries" << endl;
     cout << "Server starting on http://localhost:8080" << endl;
     svr.listen("0.0.0.0", 8080);
 